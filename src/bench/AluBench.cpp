@@ -0,0 +1,109 @@
+// Microbenchmark of the execute kernel alone: no pipeline, no memory, no
+// diagram. Reports ns per ALU::execute() for every op and for a mixed
+// instruction stream decoded the same way the simulator decodes programs.
+#include "../include/Instruction.hpp"
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+
+namespace {
+
+uint32_t rType(int funct7, int funct3) {
+    // funct7 rs2=x2 rs1=x1 funct3 rd=x3 opcode
+    return (funct7 << 25) | (2 << 20) | (1 << 15) | (funct3 << 12) | (3 << 7) | 0x33;
+}
+
+uint32_t iType(int imm, int funct3) {
+    return ((imm & 0xFFF) << 20) | (1 << 15) | (funct3 << 12) | (3 << 7) | 0x13;
+}
+
+// One instruction per AluOp that has a result
+vector<Instruction> allOps() {
+    vector<uint32_t> codes;
+    int regFunct3[] = {0, 0, 1, 2, 3, 4, 5, 5, 6, 7};
+    int regFunct7[] = {0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00};
+    for (int i = 0; i < 10; i++) {
+        codes.push_back(rType(regFunct7[i], regFunct3[i]));
+    }
+    for (int funct3 = 0; funct3 < 8; funct3++) {
+        codes.push_back(rType(0x01, funct3));
+    }
+    int immFunct3[] = {0, 2, 3, 4, 6, 7, 1, 5, 5};
+    int immValue[] = {-7, 100, 100, 0x555, 0x0F0, 0x0FF, 3, 3, 0x400 | 3};
+    for (int i = 0; i < 9; i++) {
+        codes.push_back(iType(immValue[i], immFunct3[i]));
+    }
+    codes.push_back(0x008000EF);   // jal x1, 8
+    codes.push_back(0x12345537);   // lui x10, 0x12345
+    codes.push_back(0x00001517);   // auipc x10, 0x1
+    
+    vector<Instruction> ops;
+    for (uint32_t code : codes) {
+        ops.push_back(Instruction(code));
+    }
+    return ops;
+}
+
+uint32_t nextRandom(uint32_t& state) {
+    // xorshift32, fixed seed so runs are comparable
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 20000000;
+    if (iterations <= 0) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    
+    // operand pool with the interesting edge cases mixed in
+    const size_t POOL = 1024;
+    vector<uint32_t> a(POOL), b(POOL);
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i < POOL; i++) {
+        a[i] = nextRandom(state);
+        b[i] = nextRandom(state);
+    }
+    a[0] = 0x80000000; b[0] = 0xFFFFFFFF;
+    a[1] = 7;          b[1] = 0;
+    
+    vector<Instruction> ops = allOps();
+    uint32_t checksum = 0;
+    
+    printf("%-8s %10s\n", "op", "ns/op");
+    for (const Instruction& instr : ops) {
+        AluOp op = instr.getAluOp();
+        uint32_t imm = instr.getImm();
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < iterations; i++) {
+            size_t k = i & (POOL - 1);
+            checksum += ALU::execute(op, a[k], b[k], imm, k * 4);
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        printf("%-8s %10.2f\n", ALU::name(op), ns / iterations);
+    }
+    
+    // mixed stream: every iteration executes a different, randomly chosen op
+    vector<Instruction> stream(POOL);
+    for (size_t i = 0; i < POOL; i++) {
+        stream[i] = ops[nextRandom(state) % ops.size()];
+    }
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        size_t k = i & (POOL - 1);
+        const Instruction& instr = stream[k];
+        checksum += ALU::execute(instr.getAluOp(), a[k], b[k], instr.getImm(), k * 4);
+        checksum += ALU::branchTaken(instr.getFunct3(), a[k], b[k]);
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    printf("%-8s %10.2f  (%.1f M ops/s)\n", "mixed", ns / iterations, iterations / ns * 1e3);
+    printf("checksum %08x\n", checksum);
+    return 0;
+}
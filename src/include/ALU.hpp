@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+using namespace std;
+// Operation an instruction performs in EX, resolved once at decode time
+enum class AluOp : uint8_t {
+    NONE,    // branches, NOPs: result is 0
+    // RV32I register-register
+    ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND,
+    // RV32M
+    MUL, MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU,
+    // register-immediate, also the address of loads/stores (ADDI)
+    ADDI, SLTI, SLTIU, XORI, ORI, ANDI, SLLI, SRLI, SRAI,
+    // jal/jalr return address, lui, auipc
+    LINK, LUI, AUIPC,
+    // csrr rd, mhartid, the pipelines put in their hart number
+    HARTID,
+    COUNT
+};
+
+// Execute kernel shared by all processor variants. Each op is one entry of
+// a function table, so EX is a single indexed call instead of switches on
+// opcode/funct3/funct7 every cycle. The ops themselves are inline templates
+// so translated code (FunctionalCore) can bind them without the table.
+class ALU {
+public:
+    // operands and result are raw 32-bit register patterns
+    using Function = uint32_t (*)(uint32_t rs1, uint32_t rs2, uint32_t imm, uint32_t pc);
+    using Condition = bool (*)(uint32_t rs1, uint32_t rs2);
+    static const size_t OP_COUNT = static_cast<size_t>(AluOp::COUNT);
+
+    static uint32_t execute(AluOp op, uint32_t rs1, uint32_t rs2, uint32_t imm, uint32_t pc) {
+        return table[static_cast<size_t>(op)](rs1, rs2, imm, pc);
+    }
+
+    // Branch condition, indexed by the B-type funct3 (unused encodings never branch)
+    static bool branchTaken(int funct3, uint32_t rs1, uint32_t rs2) {
+        return conditions[funct3 & 0x7](rs1, rs2);
+    }
+
+    // Result of one op, unused operands are ignored
+    template <AluOp OP>
+    static uint32_t apply(uint32_t a, uint32_t b, uint32_t imm, uint32_t pc);
+
+    // in order: BEQ, BNE, -, -, BLT, BGE, BLTU, BGEU
+    template <int FUNCT3>
+    static bool condition(uint32_t a, uint32_t b) {
+        if constexpr (FUNCT3 == 0x0) return a == b;
+        else if constexpr (FUNCT3 == 0x1) return a != b;
+        else if constexpr (FUNCT3 == 0x4) return s(a) < s(b);
+        else if constexpr (FUNCT3 == 0x5) return s(a) >= s(b);
+        else if constexpr (FUNCT3 == 0x6) return a < b;
+        else if constexpr (FUNCT3 == 0x7) return a >= b;
+        else return false;
+    }
+
+    // RV32M ops that go to the multiplier or the divider
+    static bool isMultiply(AluOp op) { return op >= AluOp::MUL && op <= AluOp::MULHU; }
+    static bool isDivide(AluOp op) { return op >= AluOp::DIV && op <= AluOp::REMU; }
+
+    // Op for the decoded fields, same results as the per-field switches it replaces
+    static AluOp resolve(int opcode, int funct3, int funct7, int32_t imm);
+
+    // Mnemonic of an op, used by the kernel benchmark
+    static const char* name(AluOp op);
+
+private:
+    static int32_t s(uint32_t value) { return static_cast<int32_t>(value); }
+    static const array<Function, OP_COUNT> table;
+    static const array<Condition, 8> conditions;
+};
+
+template <AluOp OP>
+uint32_t ALU::apply(uint32_t a, uint32_t b, uint32_t imm, uint32_t pc) {
+    switch (OP) {
+        // RV32I register-register
+        case AluOp::ADD:  return a + b;
+        case AluOp::SUB:  return a - b;
+        case AluOp::SLL:  return a << (b & 0x1F);
+        case AluOp::SLT:  return s(a) < s(b) ? 1 : 0;
+        case AluOp::SLTU: return a < b ? 1 : 0;
+        case AluOp::XOR:  return a ^ b;
+        case AluOp::SRL:  return a >> (b & 0x1F);
+        case AluOp::SRA:  return s(a) >> (b & 0x1F);
+        case AluOp::OR:   return a | b;
+        case AluOp::AND:  return a & b;
+        
+        // RV32M
+        case AluOp::MUL:
+            return a * b;
+        case AluOp::MULH:
+            // Signed * Signed -> High bits
+            return static_cast<uint32_t>((static_cast<int64_t>(s(a)) * s(b)) >> 32);
+        case AluOp::MULHSU:
+            // Signed * Unsigned -> High bits
+            return static_cast<uint32_t>(static_cast<int64_t>(static_cast<uint64_t>(static_cast<int64_t>(s(a))) * b) >> 32);
+        case AluOp::MULHU:
+            // Unsigned * Unsigned -> High bits
+            return static_cast<uint32_t>((static_cast<uint64_t>(a) * b) >> 32);
+        case AluOp::DIV:
+            // division by zero returns -1, INT_MIN / -1 overflows to INT_MIN
+            if (b == 0) return 0xFFFFFFFF;
+            if (a == 0x80000000 && s(b) == -1) return a;
+            return static_cast<uint32_t>(s(a) / s(b));
+        case AluOp::DIVU:
+            return b == 0 ? 0xFFFFFFFF : a / b;
+        case AluOp::REM:
+            // remainder of x/0 is x, INT_MIN % -1 is 0
+            if (b == 0) return a;
+            if (a == 0x80000000 && s(b) == -1) return 0;
+            return static_cast<uint32_t>(s(a) % s(b));
+        case AluOp::REMU:
+            return b == 0 ? a : a % b;
+        
+        // register-immediate
+        case AluOp::ADDI:  return a + imm;
+        case AluOp::SLTI:  return s(a) < s(imm) ? 1 : 0;
+        case AluOp::SLTIU: return a < imm ? 1 : 0;
+        case AluOp::XORI:  return a ^ imm;
+        case AluOp::ORI:   return a | imm;
+        case AluOp::ANDI:  return a & imm;
+        case AluOp::SLLI:  return a << (imm & 0x1F);
+        case AluOp::SRLI:  return a >> (imm & 0x1F);
+        case AluOp::SRAI:  return s(a) >> (imm & 0x1F);
+        
+        case AluOp::LINK:  return pc + 4;
+        case AluOp::LUI:   return imm;
+        case AluOp::AUIPC: return pc + imm;
+        case AluOp::HARTID: return 0; // hart 0 unless the pipeline knows better
+        default:           return 0;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "ProgramImage.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+using namespace std;
+// Runs a manifest of simulation jobs in one process on a work-stealing pool.
+// Manifest lines are "<input file> <variant> <cycles> [output file]", with
+// '#' comments. Jobs without an output file are compared in memory against
+// <expectedDir>/<variant>_<input name>.txt. Every input file is loaded and
+// decoded once and its image is shared by all jobs that use it.
+class BatchRunner {
+public:
+    struct Job {
+        int line;                      // manifest line, for messages
+        string inputFile;
+        string variant;
+        int cycles;
+        string outputFile;             // empty -> compare with the expected output
+    };
+    
+    enum class Status { PASSED, FAILED, WRITTEN, NO_EXPECTED, ERROR };
+    struct Result {
+        Status status = Status::ERROR;
+        string message;
+        string counters;               // JSON object, empty if the job didn't run
+    };
+    
+private:
+    vector<Job> jobs;
+    vector<Result> results;
+    map<string, shared_ptr<const ProgramImage>> images;
+    map<string, string> loadErrors;
+    string expectedDir;
+    
+    void loadImages();
+    Result runJob(const Job& job) const;
+    
+public:
+    explicit BatchRunner(const string& expectedDir);
+    
+    // Read jobs from a manifest file, throws on malformed lines
+    void loadManifest(const string& filename);
+    // Run all jobs on threadCount threads
+    void run(size_t threadCount);
+    // Print one line per job in manifest order, returns the number of failed jobs
+    size_t report(ostream& out) const;
+    // One JSON object per job in manifest order (JSON lines)
+    void writeJson(ostream& out) const;
+    
+    size_t getJobCount() const { return jobs.size(); }
+};
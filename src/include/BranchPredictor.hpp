@@ -0,0 +1,93 @@
+#pragma once
+#include "Checkpoint.hpp"
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <string>
+using namespace std;
+// Direction predictor for conditional branches, consulted in IF. Branch
+// targets are pc + imm and known from the predecoded image at fetch, so only
+// the direction is predicted. Tables are trained when the branch resolves.
+class BranchPredictor {
+public:
+    virtual ~BranchPredictor() = default;
+    virtual const char* name() const = 0;
+    // Predicted direction of the branch at pc with the given offset
+    virtual bool predict(uint32_t pc, int32_t offset) = 0;
+    // Resolved direction of the branch at pc
+    virtual void update(uint32_t pc, bool taken) = 0;
+    // Checkpoint support, the tables are part of the simulator state
+    virtual void saveState(CheckpointWriter&) const {}
+    virtual void restoreState(CheckpointReader&) {}
+};
+
+// Always not taken, the behaviour of the original pipeline
+class NotTakenPredictor : public BranchPredictor {
+public:
+    const char* name() const override { return "not-taken"; }
+    bool predict(uint32_t, int32_t) override { return false; }
+    void update(uint32_t, bool) override {}
+};
+
+// Static backward taken, forward not taken (loops are taken)
+class BtfnPredictor : public BranchPredictor {
+public:
+    const char* name() const override { return "btfn"; }
+    bool predict(uint32_t, int32_t offset) override { return offset < 0; }
+    void update(uint32_t, bool) override {}
+};
+
+// Table of 2-bit saturating counters indexed by pc
+class BimodalPredictor : public BranchPredictor {
+protected:
+    vector<uint8_t> counters;          // 0-1 not taken, 2-3 taken
+    uint32_t mask;
+    
+    void train(uint32_t index, bool taken);
+    
+public:
+    explicit BimodalPredictor(uint32_t entries = 1024);
+    const char* name() const override { return "bimodal"; }
+    bool predict(uint32_t pc, int32_t offset) override;
+    void update(uint32_t pc, bool taken) override;
+    void saveState(CheckpointWriter& out) const override;
+    void restoreState(CheckpointReader& in) override;
+};
+
+// 2-bit counters indexed by pc xor the global history of resolved branches
+class GsharePredictor : public BimodalPredictor {
+private:
+    uint32_t history;
+    
+public:
+    explicit GsharePredictor(uint32_t historyBits = 10);
+    const char* name() const override { return "gshare"; }
+    bool predict(uint32_t pc, int32_t offset) override;
+    void update(uint32_t pc, bool taken) override;
+    void saveState(CheckpointWriter& out) const override;
+    void restoreState(CheckpointReader& in) override;
+};
+
+// Direct-mapped branch target buffer for JAL/JALR. Without a hit a jump is
+// fetched past like a not-taken branch and redirected when it resolves.
+class BranchTargetBuffer {
+private:
+    struct Entry {
+        uint32_t pc;
+        uint32_t target;
+        bool valid;
+    };
+    vector<Entry> entries;
+    
+public:
+    explicit BranchTargetBuffer(uint32_t size = 0);
+    bool enabled() const { return !entries.empty(); }
+    size_t size() const { return entries.size(); }
+    bool lookup(uint32_t pc, uint32_t& target) const;
+    void update(uint32_t pc, uint32_t target);
+    void saveState(CheckpointWriter& out) const;
+    void restoreState(CheckpointReader& in);
+};
+
+// Predictor by name ("not-taken", "btfn", "bimodal", "gshare"), nullptr if unknown
+unique_ptr<BranchPredictor> createBranchPredictor(const string& name);
@@ -0,0 +1,69 @@
+#pragma once
+#include "Checkpoint.hpp"
+#include <cstdint>
+#include <vector>
+#include <string>
+using namespace std;
+// Timing model of a set-associative L1 cache in front of Memory. Only tags
+// are kept, the data always comes from Memory, so a cache changes when an
+// access completes but never what it returns.
+class Cache {
+public:
+    enum class Replacement : uint8_t { LRU, PLRU, RANDOM };
+    // WRITE_BACK allocates on store misses and writes dirty lines back on
+    // eviction; WRITE_THROUGH sends stores on through a write buffer without
+    // stalling and doesn't allocate on a store miss
+    enum class WritePolicy : uint8_t { WRITE_BACK, WRITE_THROUGH };
+    
+    struct Config {
+        uint32_t size = 8192;          // bytes
+        uint32_t lineSize = 32;        // bytes, power of two
+        uint32_t ways = 2;
+        Replacement replacement = Replacement::LRU;
+        WritePolicy writePolicy = WritePolicy::WRITE_BACK;
+        uint32_t missLatency = 10;     // extra cycles per miss or write-back
+        
+        // "size=8k,line=32,ways=2,repl=lru|plru|random,write=back|through,latency=10",
+        // every key is optional, throws runtime_error on a bad spec
+        static Config parse(const string& spec);
+    };
+    
+private:
+    struct Line {
+        uint32_t tag;
+        uint64_t lastUse;              // LRU timestamp
+        bool valid;
+        bool dirty;
+    };
+    Config config;
+    vector<Line> lines;                // sets * ways, set-major
+    vector<uint32_t> treeBits;         // PLRU tree per set, bit i = node i
+    uint32_t setCount;
+    uint32_t offsetBits;
+    uint64_t useClock;
+    uint32_t randomState;
+    
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writeBacks;
+    
+    uint32_t victim(uint32_t set);
+    void touch(uint32_t set, uint32_t way);
+    
+public:
+    Cache();
+    explicit Cache(const Config& config);
+    
+    bool enabled() const { return !lines.empty(); }
+    // Look up addr and fill the line on a miss, returns the extra cycles
+    // the access takes (0 on a hit)
+    uint32_t access(uint32_t addr, bool write);
+    
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+    uint64_t getWriteBacks() const { return writeBacks; }
+    const Config& getConfig() const { return config; }
+    
+    void saveState(CheckpointWriter& out) const;
+    void restoreState(CheckpointReader& in);
+};
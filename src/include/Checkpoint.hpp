@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <type_traits>
+#include "MappedFile.hpp"
+using namespace std;
+
+// Binary checkpoint files. Each component appends its state in the order it
+// is restored. Values are stored in host byte order, like the pages of Memory,
+// and are only meant to be read back by the same build of the simulator.
+class CheckpointWriter {
+private:
+    string buffer;
+    
+public:
+    template <class T>
+    void put(const T& value) {
+        static_assert(is_trivially_copyable<T>::value, "only plain values can be checkpointed");
+        putBytes(&value, sizeof(T));
+    }
+    void putBytes(const void* data, size_t size);
+    
+    // Write everything put so far to filename
+    void save(const string& filename) const;
+};
+
+// Reads a checkpoint straight out of a read-only mapping of the file
+class CheckpointReader {
+private:
+    string filename;
+    MappedFile file;
+    string_view data;
+    size_t offset;
+    
+public:
+    explicit CheckpointReader(const string& filename);
+    
+    template <class T>
+    T get() {
+        static_assert(is_trivially_copyable<T>::value, "only plain values can be checkpointed");
+        T value;
+        getBytes(&value, sizeof(T));
+        return value;
+    }
+    void getBytes(void* out, size_t size);
+    // View of the next size bytes, valid while the reader lives
+    string_view getView(size_t size);
+    
+    const string& getFilename() const { return filename; }
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include "PipelineProcessor.hpp"
+using namespace std;
+// In-order superscalar variant: fetches, decodes and issues up to two
+// instructions per cycle. Every stage has a second slot next to the latch of
+// the base class, the base latch always holds the older instruction. Values
+// are forwarded like in ForwardingProcessor and branches resolve in EX.
+// Two instructions issue together unless a pairing rule holds the younger:
+// one memory access, one branch/jump and one multiply/divide per cycle, and
+// the younger may not read the older's result.
+class DualIssueProcessor : public PipelineProcessor<DualIssueProcessor> {
+    friend class PipelineProcessor<DualIssueProcessor>;
+protected:
+    // second slot of every stage
+    PipelineRegister ifId2;
+    PipelineRegister idEx2;
+    PipelineRegister exMem2;
+    PipelineRegister memWb2;
+    
+    // instructions of the IF/ID group that enter EX this cycle, 0 to 2
+    int issueCount;
+    // pcs that started fetching this cycle, drawn in the diagram at endCycle
+    uint32_t fetchedPcs[2];
+    int fetchedCount;
+    
+    void beginCycle();
+    void endCycle();
+    void stageIF();
+    void detectHazards();
+    void stageID();
+    void stageEX();
+    void stageMEM();
+    void stageWB();
+    void updatePipelineTable();
+    bool pipelineEmpty() const override;
+    // the second slots aren't covered by the base class's idle check
+    int skipIdleCycles(int) { return 0; }
+    
+    // Fetch pc into an empty IF/ID slot, false if fetching stops for this cycle
+    bool fetchInto(PipelineRegister& slot);
+    // The ID instruction reads a load that is in EX this cycle
+    bool mustWait(const Instruction& instr) const;
+    // No pairing rule keeps the younger instruction from issuing with the older
+    static bool canPair(const Instruction& older, const Instruction& younger);
+    // ALU and branch resolution of one slot, true on a misprediction
+    bool execute(const PipelineRegister& in, PipelineRegister& out);
+    
+    void saveVariantState(CheckpointWriter& out, bool includeTracker) const override;
+    void restoreVariantState(CheckpointReader& in) override;
+    
+public:
+    DualIssueProcessor();
+    ~DualIssueProcessor() override = default;
+    // The second slots only exist for the five stages
+    void setPipelineDepth(const PipelineDepth&) override {
+        throw runtime_error("dualissue only models the five-stage pipeline");
+    }
+    // Only the scalar pipelines run as harts
+    void setHartId(uint32_t) override {
+        throw runtime_error("dualissue runs a single hart");
+    }
+};
@@ -1,16 +1,17 @@
 #pragma once
-#include "Processor.hpp"
+#include "PipelineProcessor.hpp"
 using namespace std;
-class ForwardingProcessor : public Processor {
+class ForwardingProcessor : public PipelineProcessor<ForwardingProcessor> {
+    friend class PipelineProcessor<ForwardingProcessor>;
 protected:
-    //overriding hazard detection for forwarding processor 
-    void detectHazards() override;
+    //hazard detection for forwarding processor 
+    void detectHazards();
     
     // ID stage don't detect branch address (like in RIPES simulator)
-    void stageID() override;
+    void stageID();
     
     // EX stage in forwarding detect branch address (if taken) (like in RIPES simulator)
-    void stageEX() override;
+    void stageEX();
     
 public:
     ForwardingProcessor();
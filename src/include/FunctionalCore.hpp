@@ -0,0 +1,71 @@
+#pragma once
+#include "Memory.hpp"
+#include "RegisterFile.hpp"
+#include <vector>
+using namespace std;
+// ISA-level interpreter: retires instructions with no pipeline latches,
+// hazards or diagram tracking. It works directly on a processor's registers
+// and memory, so the pipeline can pick up where it stopped.
+//
+// Straight-line runs ending at a branch or jalr are translated once into
+// blocks of pre-bound handlers with their operands resolved (a jal is
+// followed to its target). Each block
+// remembers the blocks it went to, so a hot loop goes from block to block
+// without looking anything up. The program image never changes after
+// load, so translations stay valid for the lifetime of the core.
+class FunctionalCore {
+public:
+    // Register values while running, index 32 absorbs writes to x0
+    struct State {
+        uint32_t regs[33];
+        Memory* memory;
+    };
+    
+    // One translated instruction, the handler returns the next pc
+    struct MicroOp;
+    using Handler = uint32_t (*)(State& state, const MicroOp& op);
+    struct MicroOp {
+        Handler handler;
+        uint32_t pc;
+        uint32_t imm;
+        uint8_t rd;                    // 32 when the result is discarded
+        uint8_t rs1;
+        uint8_t rs2;
+    };
+    
+    // Longest straight-line run put in one block
+    static const size_t MAX_BLOCK_LENGTH = 64;
+    
+private:
+    struct Block {
+        vector<MicroOp> ops;           // ends with the branch/jalr, if any
+        uint32_t successorPc[2];       // chained successors, next in line first
+        int successor[2];              // block index, -1 if not linked yet
+    };
+    
+    RegisterFile& registers;
+    Memory& memory;
+    uint32_t pc;
+    uint64_t instructionCount;
+    
+    vector<Block> blocks;
+    vector<int> blockAt;               // block index by (pc - textBase)/4, -1 if none
+    
+    // Translate a single instruction / the block starting at pc
+    static MicroOp translate(const Instruction& instr, uint32_t pc);
+    int findBlock(uint32_t pc);
+    // Run count instructions one at a time (outside the image, or a partial block)
+    uint32_t stepMany(State& state, uint32_t pc, uint64_t count) const;
+    
+public:
+    FunctionalCore(RegisterFile& registers, Memory& memory, uint32_t pc);
+    
+    // Execute the instruction at pc and advance pc
+    void step();
+    // Execute count instructions
+    void run(uint64_t count);
+    
+    uint32_t getPc() const { return pc; }
+    uint64_t getInstructionCount() const { return instructionCount; }
+    size_t getBlockCount() const { return blocks.size(); }
+};
@@ -2,28 +2,47 @@
 #include <string>
 #include <cstdint>
 #include <iostream>
+#include "ALU.hpp"
 using namespace std;
+// Coarse opcode class resolved once at decode time
+enum class InstrClass : uint8_t {
+    NOP,     // unknown / padding instruction
+    ALU,     // R-type incl. RV32M
+    ALU_IMM, // I-type arithmetic
+    LOAD,
+    STORE,
+    BRANCH,
+    JAL,
+    JALR,
+    LUI,
+    AUIPC,
+    SYSTEM   // ecall/ebreak and CSR accesses, only mhartid reads non-zero
+};
+
+// Compact decoded record, the assembly text lives in Memory's side table.
+// Trivially copyable so it can be stored inline in the pipeline latches.
 class Instruction {
 private:
-    uint32_t machineCode;
-    string assembly;
-    
-    // Decoded fields
-    int opcode;
-    int rd;
-    int rs1;
-    int rs2;
-    int funct3;
-    int funct7;
-    int imm;
+    uint32_t machineCode = 0;
+    
+    // Decoded fields (a default constructed Instruction is a decoded NOP)
+    uint8_t opcode = 0;
+    uint8_t rd = 0;
+    uint8_t rs1 = 0;
+    uint8_t rs2 = 0;
+    uint8_t funct3 = 0;
+    uint8_t funct7 = 0;
+    InstrClass instrClass = InstrClass::NOP;
+    bool writesRdFlag = false; // result goes to a non-x0 rd in WB
+    AluOp aluOp = AluOp::NONE; // what EX computes, see ALU
+    int32_t imm = 0;
     
 public:
-    Instruction();
-    Instruction(uint32_t machineCode, const string& assembly = "");
+    Instruction() = default;
+    explicit Instruction(uint32_t machineCode);
     
     // Getters
     uint32_t getMachineCode() const { return machineCode; }
-    string getAssembly() const { return assembly; }
     int getOpcode() const { return opcode; }
     int getRd() const { return rd; }
     int getRs1() const { return rs1; }
@@ -31,10 +50,17 @@ public:
     int getFunct3() const { return funct3; }
     int getFunct7() const { return funct7; }
     int getImm() const { return imm; }
+    InstrClass getClass() const { return instrClass; }
+    bool writesRd() const { return writesRdFlag; }
+    AluOp getAluOp() const { return aluOp; }
     
     // Decode the instruction fields
     void decode();
     
+    // Assembly text in the same style as the input files (e.g. "lw x8, 0(x7)"),
+    // used for programs loaded from binaries that carry no assembly
+    string disassemble() const;
+    
     // Instruction identifiers 
     bool isRType() const;
     bool isIType() const;
@@ -50,4 +76,7 @@ public:
     bool isLoad() const;
     bool isJump() const;
     bool isALU() const;
+    // ecall/ebreak, they end the run with --halt
+    bool isEcall() const { return machineCode == 0x00000073; }
+    bool isEbreak() const { return machineCode == 0x00100073; }
 };
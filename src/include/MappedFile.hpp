@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <stdexcept>
+using namespace std;
+
+// Read-only memory mapping of a whole file, unmapped on destruction.
+// Views handed out by view() stay valid as long as the mapping lives.
+class MappedFile {
+private:
+    const char* data;
+    size_t size;
+    
+    void unmap();
+    
+public:
+    MappedFile();
+    explicit MappedFile(const string& filename);
+    ~MappedFile();
+    
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    string_view view() const { return string_view(data, size); }
+    size_t getSize() const { return size; }
+};
@@ -1,20 +1,65 @@
 #pragma once
 #include <vector>
+#include <array>
+#include <memory>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include "Instruction.hpp"
-#include <fstream>
+#include "ProgramImage.hpp"
+#include "Checkpoint.hpp"
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
 using namespace std;
 class Memory {
+public:
+    // Data memory covers the full 32-bit address space in 4 KB pages that
+    // are allocated on first write through a two-level page table
+    static const uint32_t PAGE_BITS = 12;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static const uint32_t TABLE_BITS = 10;
+    static const uint32_t TABLE_SIZE = 1u << TABLE_BITS;
+    
 private:
-    vector<uint8_t> data;
-    vector<Instruction> instructions;
+    using Page = array<uint8_t, PAGE_SIZE>;
+    struct PageTable {
+        array<unique_ptr<Page>, TABLE_SIZE> pages;
+    };
+    // address bits [31:22] pick the page table, [21:12] the page
+    array<unique_ptr<PageTable>, TABLE_SIZE> directory;
+    // page numbers (address >> PAGE_BITS) allocated since the last reset
+    vector<uint32_t> touchedPages;
+    
+    // misaligned half/word accesses, handled byte by byte (or trapped)
+    mutable uint64_t misalignedAccesses;
+    bool trapMisaligned;
+    void misaligned(uint32_t address, const char* access) const;
+    
+    // page holding address, nullptr if it was never written (reads as 0)
+    const uint8_t* findPage(uint32_t address) const;
+    // page holding address, allocated zero-filled if needed
+    uint8_t* touchPage(uint32_t address);
+    
+    // Predecoded program image, built once at load time and never modified
+    shared_ptr<const ProgramImage> program;
+    
+    // Hart view of a shared memory (see attach), nullptr for a private one.
+    // Pages this memory doesn't have are read from shared, the first store
+    // to a page copies it and the stores are logged until commitStores().
+    struct BufferedStore {
+        uint32_t address;
+        uint32_t value;
+        int funct3;
+    };
+    Memory* shared;
+    vector<BufferedStore> storeBuffer;
+    
+    // Drop the touched pages and their tables
+    void releasePages();
     
 public:
-    Memory(size_t size = 1024*1024);  // Default 1MB memory
+    Memory();
     
     // Memory access functions
     uint8_t readByte(uint32_t address) const;
@@ -25,11 +70,47 @@ public:
     void writeHalf(uint32_t address, uint16_t value);
     void writeWord(uint32_t address, uint32_t value);
     
+    // Load/store as the given load or store funct3 (lb/lh/lw/lbu/lhu, sb/sh/sw),
+    // loads are sign or zero extended, unknown widths load 0 and store nothing
+    uint32_t load(int funct3, uint32_t address) const;
+    void store(int funct3, uint32_t address, uint32_t value);
+    
+    // Copy bytes into memory starting at address
+    void writeBlock(uint32_t address, string_view bytes);
+    
     // Instruction memory functions
+    // Load a text, ELF or flat binary program and its initial data
     void loadInstructions(const string& filename);
-    Instruction getInstruction(uint32_t pc) const;
-    size_t getInstructionCount() const { return instructions.size(); }
+    void setProgram(shared_ptr<const ProgramImage> image);
+    const ProgramImage& getProgram() const { return *program; }
+    // Pointer into the program image (NOP outside it), valid until the next load
+    const Instruction* getInstruction(uint32_t pc) const { return program->getInstruction(pc); }
+    string_view getAssembly(uint32_t pc) const { return program->getAssembly(pc); }
+    size_t getInstructionCount() const { return program->getInstructionCount(); }
+    bool isInstructionAddress(uint32_t pc) const { return program->contains(pc); }
+    
+    // Throw on misaligned half/word accesses instead of splitting them
+    void setMisalignedTrap(bool enabled) { trapMisaligned = enabled; }
+    bool trapsMisaligned() const { return trapMisaligned; }
+    uint64_t getMisalignedAccesses() const { return misalignedAccesses; }
     
-    // Reset memory to 0
+    // Number of data pages allocated so far
+    size_t getTouchedPageCount() const { return touchedPages.size(); }
+    
+    // Reset memory to 0 and detach it, only the touched pages are released
     void reset();
+    
+    // Become a hart's view of shared: this memory's own pages are dropped,
+    // loads see shared plus this hart's stores, which nobody else sees
+    // until commitStores(). shared must not change while harts run.
+    void attach(Memory& sharedMemory);
+    // Apply the buffered stores to the shared memory in program order and
+    // read it afresh from now on, call with no hart running
+    void commitStores();
+    size_t getBufferedStores() const { return storeBuffer.size(); }
+    
+    // Checkpoint the touched pages and counters, the program image is not
+    // included and must already be loaded when restoring
+    void saveState(CheckpointWriter& out) const;
+    void restoreState(CheckpointReader& in);
 };
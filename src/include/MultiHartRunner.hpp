@@ -0,0 +1,43 @@
+#pragma once
+#include "Processor.hpp"
+#include <memory>
+#include <vector>
+#include <sstream>
+using namespace std;
+// Runs several harts, each a processor of its own, against one shared
+// memory. A hart reads its number with csrr mhartid. The harts run in
+// parallel on host threads for a quantum of cycles at a time and meet at a
+// barrier in between. During a quantum a hart sees the shared memory as it
+// was at the start plus its own stores. At the barrier the stores of hart
+// 0, 1, ... are applied in that order, and the other harts see them from
+// the next quantum on. Nothing shared changes while the harts run, so the
+// result depends on the quantum but not on the host threads.
+class MultiHartRunner {
+private:
+    Memory shared;
+    vector<unique_ptr<Processor>> harts;
+    vector<unique_ptr<ostringstream>> diagrams; // each hart's output, printed in hart order
+    int quantum;
+    size_t threadCount;
+    uint64_t quanta;
+    uint64_t committedStores;
+    
+public:
+    // threadCount 0 = one per hart, at most the host's cores
+    MultiHartRunner(int quantum, size_t threadCount);
+    
+    // Add the next hart, it gets the number of harts added before it
+    void addHart(unique_ptr<Processor> hart);
+    // Load the program into the shared memory, every hart starts at its entry
+    void loadProgram(const string& filename);
+    Processor& getHart(size_t id) { return *harts[id]; }
+    size_t getHartCount() const { return harts.size(); }
+    
+    // Run every hart for cycles cycles (with --halt until all of them stopped),
+    // then print the harts' output to out
+    void run(int cycles, ostream& out);
+    // {"quantum": ..., "harts": [one counter object per hart]} on one line
+    void writeCountersJson(ostream& out) const;
+    // Quanta and stores, then each hart's --stats report
+    void printStats(ostream& out) const;
+};
@@ -1,10 +1,11 @@
 #pragma once
-#include "Processor.hpp"
+#include "PipelineProcessor.hpp"
 using namespace std;
-class NonForwardingProcessor : public Processor {
+class NonForwardingProcessor : public PipelineProcessor<NonForwardingProcessor> {
+    friend class PipelineProcessor<NonForwardingProcessor>;
 protected:
-    // Override hazard detection for stall implementation
-    void detectHazards() override;
+    // Hazard detection for stall implementation, branches resolve in ID
+    void detectHazards();
     
 public:
     NonForwardingProcessor();
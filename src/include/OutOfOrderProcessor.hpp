@@ -0,0 +1,127 @@
+#pragma once
+#include "Processor.hpp"
+#include <deque>
+using namespace std;
+// Tomasulo-style out-of-order core on the same decoder, register file and
+// memory as the pipelines. IF fetches one instruction per cycle along the
+// predicted path. Dispatch renames it into the reorder buffer and the issue
+// queue (or the load/store queue). Every cycle the oldest ready instruction
+// of each unit (ALU, multiplier/divider, memory port) issues, results are
+// broadcast to the waiting instructions when they complete and commit
+// writes them back in program order, one per cycle. A mispredicted branch
+// flushes everything younger as soon as it completes. Stores write memory
+// at commit, loads wait for the addresses of all older stores and take
+// their value from the youngest older store that covers them.
+// Instead of the stage diagram the run prints a timeline with the dispatch,
+// issue, complete and commit cycle of every dispatched instruction.
+class OutOfOrderProcessor : public Processor {
+public:
+    // Entries of the reorder buffer, the issue queue and the load/store queue
+    struct QueueSizes {
+        int reorderBuffer = 32;
+        int issueQueue = 16;
+        int loadStoreQueue = 8;
+    };
+    
+protected:
+    // Functional units, each starts at most one instruction per cycle
+    enum Unit : uint8_t { UNIT_ALU, UNIT_MULDIV, UNIT_MEMORY, UNIT_COUNT };
+    
+    // Reorder buffer entry. Instructions that are not issued yet are the
+    // issue queue (or, for loads/stores until commit, the load/store queue),
+    // so those queues are just occupancy limits on top of the buffer.
+    struct RobEntry {
+        PipelineRegister op;           // instruction, operands, result, prediction
+        uint64_t seq;                  // dispatch order, row of the timeline
+        int waitsOn[2];                // slot producing rs1/rs2, -1 once the value is in op
+        Unit unit;
+        bool issued;
+        bool done;                     // result broadcast, ready to commit
+        int completeCycle;
+    };
+    // One line of the timeline, -1 = not reached (yet)
+    struct TimelineRow {
+        uint32_t pc;
+        int dispatch;
+        int issue;
+        int complete;
+        int commit;
+        bool flushed;
+    };
+    // Occupancy of one structure over the run
+    struct Occupancy {
+        uint64_t total = 0;            // entries summed over all cycles
+        int peak = 0;
+        uint64_t fullCycles = 0;       // dispatch stalled because it was full
+    };
+    
+    QueueSizes sizes;
+    vector<RobEntry> rob;              // circular, oldest entry at robHead
+    int robHead;
+    int robCount;
+    int issueCount;                    // dispatched, not issued ALU and MUL/DIV entries
+    int loadStoreCount;                // dispatched, not committed loads and stores
+    array<int, 32> producer;           // slot that writes each register, -1 = register file
+    int dividerFreeCycle;              // the divider is not pipelined
+    uint64_t nextSeq;
+    Occupancy robStats;
+    Occupancy issueStats;
+    Occupancy loadStoreStats;
+    
+    // Rows not written out yet, the first one belongs to seq timelineFirst
+    deque<TimelineRow> timeline;
+    uint64_t timelineFirst;
+    
+    // Phases of a cycle, oldest work first so nothing passes two in a cycle
+    void commit();
+    void complete();
+    void issue();
+    void dispatch();
+    void endCycle();
+    void finishRun();
+    bool pipelineEmpty() const override { return robCount == 0 && Processor::pipelineEmpty(); }
+    
+    int slotAt(int index) const { return (robHead + index) % sizes.reorderBuffer; }
+    static Unit unitOf(const Instruction& instr);
+    static uint32_t resultOf(const RobEntry& entry) {
+        return entry.op.instruction.isLoad() ? entry.op.readData : entry.op.aluResult;
+    }
+    // Rename one source operand of a new entry
+    void readOperand(RobEntry& entry, int operand, int reg);
+    // Start the entry at index on its unit, the latency or -1 if it can't start yet
+    int execute(int index, RobEntry& entry);
+    // Value of the load at index from older stores or memory, false while
+    // an older store address is unknown or only partly covers it
+    bool loadValue(int index, const RobEntry& entry, uint32_t& value) const;
+    // Hand a completed result to the entries waiting for it
+    void broadcast(int slot);
+    // Drop every entry younger than index and rebuild the renaming
+    void flushAfter(int index);
+    TimelineRow& row(uint64_t seq) { return timeline[seq - timelineFirst]; }
+    static bool finished(const TimelineRow& row) { return row.commit >= 0 || row.flushed; }
+    // Format the first count rows of the timeline into out
+    void formatTimeline(string& out, size_t count) const;
+    // Streaming: write out the finished rows at the front
+    void writeFinishedRows();
+    
+    void saveVariantState(CheckpointWriter& out, bool includeTracker) const override;
+    void restoreVariantState(CheckpointReader& in) override;
+    void writeVariantJson(ostream& out) const override;
+    
+public:
+    OutOfOrderProcessor();
+    ~OutOfOrderProcessor() override = default;
+    void run(int cycles) override;
+    void simulate(int cycles) override;
+    // There are no IF/EX/MEM stages to split
+    void setPipelineDepth(const PipelineDepth&) override {
+        throw runtime_error("outoforder has no stages to split, use --rob/--iq/--lsq");
+    }
+    // Only the in-order scalar pipelines run as harts
+    void setHartId(uint32_t) override {
+        throw runtime_error("outoforder runs a single hart");
+    }
+    // Resize the queues, call before run()
+    void setQueueSizes(const QueueSizes& newSizes);
+    void printVariantStats(ostream& out) const override;
+};
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+using namespace std;
+// Why ID could not advance in a stall cycle
+enum StallCause : uint8_t {
+    STALL_RAW_EX,                      // noforward: source written by the instruction in EX,
+                                       // forward: ... in an EX sub-stage before the last
+    STALL_RAW_MEM,                     // noforward: ... in MEM2.. (only with MEM sub-stages)
+    STALL_RAW_WB,                      // noforward: ... in WB
+    STALL_LOAD_USE,                    // forward: source loaded by an instruction not out of MEM yet
+    STALL_ICACHE,                      // fetch waiting for an instruction cache miss
+    STALL_DCACHE,                      // MEM and everything behind it waiting for a data cache miss
+    STALL_MULTIPLY,                    // source not out of the multiplier yet
+    STALL_DIVIDE,                      // EX and everything behind it held by the divider
+    STALL_CAUSE_COUNT
+};
+// Stages that can hold a bubble, IF always fetches unless it is stalled
+enum BubbleStage : uint8_t {
+    BUBBLE_ID, BUBBLE_EX, BUBBLE_MEM, BUBBLE_WB,
+    BUBBLE_STAGE_COUNT
+};
+
+// Event counters of a pipeline run. Plain values so they can be checkpointed
+// as they are; the processor derives CPI/IPC and formats them.
+struct PerfCounters {
+    uint64_t stalls[STALL_CAUSE_COUNT] = {};
+    uint64_t bubbles[BUBBLE_STAGE_COUNT] = {};  // cycles the stage had no instruction
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    // branch prediction
+    uint64_t branches = 0;
+    uint64_t branchMisses = 0;
+    uint64_t jumps = 0;
+    uint64_t jumpMisses = 0;
+    uint64_t flushCycles = 0;          // wrong-path fetches thrown away
+    // superscalar issue
+    uint64_t dualIssues = 0;           // cycles two instructions entered EX
+    uint64_t splitIssues = 0;          // ... only the older one, a pairing rule held the other
+    
+    uint64_t stallCycles() const {
+        uint64_t total = 0;
+        for (uint64_t count : stalls) {
+            total += count;
+        }
+        return total;
+    }
+    uint64_t flushes() const { return branchMisses + jumpMisses; }
+};
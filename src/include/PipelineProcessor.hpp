@@ -0,0 +1,54 @@
+#pragma once
+#include "Processor.hpp"
+using namespace std;
+// Cycle loop shared by the pipeline variants. Derived is the variant itself
+// and acts as the hazard and branch-resolution policy: it provides
+// detectHazards() and may hide any stage and the per-cycle bookkeeping
+// (beginCycle()/endCycle()). The stages are called
+// through Derived so every variant compiles into its own loop without any
+// virtual calls per cycle.
+template <class Derived>
+class PipelineProcessor : public Processor {
+public:
+    void run(int cycles) override {
+        PipelineProcessor::simulate(cycles);
+        finishRun();
+    }
+    
+    void simulate(int cycles) override {
+        Derived& self = static_cast<Derived&>(*this);
+        for (int i = 0; i < cycles && haltReason == HaltReason::NONE; ++i) {
+            // cycles spent only waiting for a miss or the divider go in one step
+            i += self.skipIdleCycles(cycles - i);
+            if (i == cycles) {
+                break;
+            }
+            self.beginCycle();
+            
+            // Execute pipeline stages in reverse order to avoid overwriting
+            self.stageWB();
+            if (haltReason != HaltReason::NONE) {
+                // --halt: an ecall/ebreak retired, nothing younger gets further
+                cycleCount++;
+                break;
+            }
+            self.stageMEM();
+            
+            // a data cache miss holds MEM and everything behind it,
+            // the divider holds EX and everything behind it
+            if (!memoryStall) {
+                self.stageEX();
+                if (!executeStall) {
+                    // Detect hazards BEFORE ID and IF stages
+                    self.detectHazards();
+                    
+                    // Now execute ID and IF, updated stall flag
+                    self.stageID();
+                    self.stageIF();
+                }
+            }
+            
+            self.endCycle();
+        }
+    }
+};
@@ -1,10 +1,12 @@
 #pragma once
 #include "Instruction.hpp"
-#include <memory>
+#include <type_traits>
 using namespace std;
+// Plain-old-data latch: the decoded instruction is stored inline so advancing
+// the pipeline is a flat copy with no heap or refcount traffic
 struct PipelineRegister {
     bool valid = false;
-    shared_ptr<Instruction> instruction = nullptr;
+    Instruction instruction;
     uint32_t pc = 0;
     int aluResult = 0;
     int readData = 0;
@@ -13,17 +15,11 @@ struct PipelineRegister {
     bool isBType = false;
     bool branchTaken = false;
     uint32_t branchTarget = 0;
+    bool predictedTaken = false;       // IF fetched the predicted target next
+    uint32_t predictedTarget = 0;
     
     void clear() {
-        valid = false;
-        instruction = nullptr;
-        pc = 0;
-        aluResult = 0;
-        readData = 0;
-        rs1Value = 0;
-        rs2Value = 0;
-        isBType = false;
-        branchTaken = false;
-        branchTarget = 0;
+        *this = PipelineRegister();
     }
 };
+static_assert(is_trivially_copyable<PipelineRegister>::value, "pipeline latches must stay trivially copyable");
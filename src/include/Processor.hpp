@@ -2,6 +2,10 @@
 #include "Memory.hpp"
 #include "RegisterFile.hpp"
 #include "PipelineRegister.hpp"
+#include "FunctionalCore.hpp"
+#include "BranchPredictor.hpp"
+#include "PerfCounters.hpp"
+#include "Cache.hpp"
 #include <vector>
 #include <string>
 #include <map>
@@ -12,13 +16,44 @@
 #include <climits>
 using namespace std;
 class Processor {
+public:
+    // initial sp for ELF programs, top of the user stack
+    static const uint32_t STACK_TOP = 0x7FFFFFF0;
+    // checkpoint file header
+    static constexpr uint32_t CHECKPOINT_MAGIC = 0x4B435652;   // "RVCK"
+    static constexpr uint32_t CHECKPOINT_VERSION = 8;
+    
+    // Sub-stages of IF, EX and MEM, 1 each is the classic five-stage
+    // pipeline. Only the first sub-stage does the work (fetch, ALU and
+    // branch resolution, memory access), the others pass the instruction
+    // on, so results reach the forwarding paths and WB later.
+    struct PipelineDepth {
+        static const int MAX = 4;      // per group, a diagram cell is 16 bits
+        int fetch = 1;
+        int execute = 1;
+        int memory = 1;
+        
+        int stages() const { return fetch + 1 + execute + memory + 1; }
+        bool operator==(const PipelineDepth& other) const {
+            return fetch == other.fetch && execute == other.execute && memory == other.memory;
+        }
+        // "if=2,ex=2,mem=2", every key is optional, throws runtime_error on a bad spec
+        static PipelineDepth parse(const string& spec);
+    };
+    
 protected:
+    // "forward", "noforward", ... as createProcessor knows it, checkpoints
+    // only restore into the variant that wrote them
+    string variantName;
+    
     // Processor state
     uint32_t pc;
     uint32_t btpc ; // last instruction branch taken target address 
     bool tibt ; //last instrcution branch taken or not 
     Memory memory;
     RegisterFile registers;
+    // What csrr mhartid reads, set by MultiHartRunner
+    uint32_t hartId;
     
     // Pipeline registers
     PipelineRegister ifId;
@@ -26,49 +61,259 @@ protected:
     PipelineRegister exMem;
     PipelineRegister memWb;
     
+    // Latches between the sub-stages of a deeper pipeline, empty for depth 1.
+    // fetchLine[0] is written by IF1 and read by IF2, the last one feeds
+    // ifId; executeLine feeds exMem and memoryLine feeds memWb the same way.
+    PipelineDepth depth;
+    vector<PipelineRegister> fetchLine;
+    vector<PipelineRegister> executeLine;
+    vector<PipelineRegister> memoryLine;
+    // Move EX2.. (MEM2..) one sub-stage ahead, returns the latch EX1 (MEM1) writes
+    PipelineRegister& advanceExecute() { return executeLine.empty() ? exMem : advanceLine(executeLine, exMem); }
+    PipelineRegister& advanceMemory() { return memoryLine.empty() ? memWb : advanceLine(memoryLine, memWb); }
+    static PipelineRegister& advanceLine(vector<PipelineRegister>& line, PipelineRegister& next);
+    // Instructions past ID that haven't written back, youngest first:
+    // position 0 left EX1 this cycle, the last one is memWb
+    int backEndSize() const { return depth.execute + depth.memory; }
+    const PipelineRegister& backEnd(int position) const {
+        if (position < depth.execute - 1) {
+            return executeLine[position];
+        }
+        if (position == depth.execute - 1) {
+            return exMem;
+        }
+        position -= depth.execute;
+        return position < depth.memory - 1 ? memoryLine[position] : memWb;
+    }
+    
     // Statistics
     int cycleCount;
-    int instructionCount;
+    uint64_t instructionCount;         // retired in WB
+    PerfCounters counters;
     
     // Internal tracking for stalls 
     bool stall;
     
+    // Branch prediction, consulted in IF and trained where branches resolve
+    unique_ptr<BranchPredictor> predictor;
+    BranchTargetBuffer btb;
+    
+    // L1 caches, disabled unless configured. A miss keeps the access in its
+    // stage for the miss latency: fetch sends bubbles to ID meanwhile, a data
+    // miss holds MEM and every stage behind it (memoryStall).
+    Cache icache;
+    Cache dcache;
+    uint32_t fetchWait;                // cycles left on the pending fetch miss
+    bool fetchStarted;                 // the cache was already asked about pc
+    uint32_t memoryWait;
+    bool memoryStarted;
+    bool memoryStall;                  // EX, ID and IF hold this cycle
+    bool waitForFetch();
+    bool waitForData(const PipelineRegister& access);
+    
+    // Multi-cycle RV32M units, both 1 cycle unless configured. The
+    // multiplier is pipelined: a product is ready mulLatency cycles after it
+    // entered EX and only its dependents wait (registerReady). The divider
+    // is iterative and keeps the instruction in EX for divLatency cycles,
+    // holding everything behind it (executeStall).
+    int mulLatency;
+    int divLatency;
+    array<int, 32> registerReady;      // first cycle a reader of the register may be in EX
+    int executeWait;
+    bool executeStarted;
+    bool executeStall;
+    // Called by stageEX for a valid instruction, true while the divider holds it
+    bool holdInExecute(const Instruction& instr);
+    // The instruction leaves EX this cycle, note when its result can be read
+    void markResultReady(const Instruction& instr);
+    // The ID instruction reads a product that isn't ready for its EX yet
+    bool waitsForMultiplier(const Instruction& instr) const;
+    
+    // While a miss or the divider holds its stage and nothing ahead of it is
+    // left to move, a cycle only counts stalls and bubbles. Account for up to
+    // limit such cycles at once and return how many, the counters, the
+    // diagram and the streamed windows come out as if they ran one by one.
+    int skipIdleCycles(int limit) {
+        if (memoryWait == 0 && executeWait == 0 && fetchWait == 0) {
+            return 0;
+        }
+        return skipWaitingCycles(limit);
+    }
+    int skipWaitingCycles(int limit);
+    
+    // Instructions that can enter EX per cycle, 1 for the scalar variants
+    int issueWidth;
+    
+    // --halt: an ecall/ebreak retiring ends the run, and IF fetches nothing
+    // past the end of the program so the run also ends once the pipeline
+    // has drained. The loop stops as soon as haltReason is set.
+    enum class HaltReason : uint8_t { NONE, ECALL, EBREAK, END };
+    bool haltEnabled;
+    HaltReason haltReason;
+    uint32_t haltPc;                   // the ecall/ebreak
+    uint32_t exitCode;                 // a0 when it retired
+    // No instruction is in any latch (or queue) any more
+    virtual bool pipelineEmpty() const;
+    // IF reached pc past the end of the program with --halt: no fetch, and
+    // the run is over if nothing is left in flight
+    void fetchPastEnd();
+    
+    // Without the diagram the tracker is not updated at all
+    bool diagramEnabled;
+    
+    // Pipeline stages. A cell stores one bit per sub-stage so it can hold
+    // several of them (e.g. MEM/IF in a loop), rendered in bit order WB,
+    // MEMn..MEM1, EXn..EX1, ID, IFn..IF1 (see stageBit)
+    enum Stage : uint8_t { STAGE_WB, STAGE_MEM, STAGE_EX, STAGE_ID, STAGE_IF };
+    // One non-empty cell of a tracker row, every other cycle is "-"
+    struct StageCell {
+        int cycle;
+        uint16_t stages;               // stageBit mask
+    };
     // Structure to track instruction stages through all cycles
     struct InstructionTracker {
-        string assembly;               // Instruction text
         uint32_t pc;                   // Program counter value
         int firstCycle;                // First cycle when this instruction entered pipeline
-        vector<string> stages;         // Modified to handle multiple stages per cycle
+        vector<StageCell> cells;       // Non-empty cells in increasing cycle order
+        bool pendingOutput;            // Listed in activeRows
     };
-    // Table to track all instructions
+    // Table to track all instructions, row i belongs to pc textBase + i*4
     vector<InstructionTracker> pipelineTable;
-    // Pipeline stage implementation
-    virtual void stageIF();
-    virtual void stageID();
-    virtual void stageEX();
-    virtual void stageMEM();
-    virtual void stageWB();
-    // Hazard detection and handling
-    virtual void detectHazards() = 0;
+    
+    // Streaming diagram output, 0 -> whole diagram printed at the end of run
+    int streamWindow;
+    int streamedCycles;                // Cycles already written out
+    vector<uint32_t> activeRows;       // Rows with cells not written out yet
+    string outputBuffer;               // Reused buffer for formatting the diagram
+    ostream* output;                   // Where the diagram goes, cout by default
+    // Default pipeline stages. They are not virtual: PipelineProcessor calls
+    // them through the variant, which may hide stageID/stageEX with its own
+    // and must provide detectHazards()
+    void stageIF();
+    void stageID();
+    void stageEX();
+    void stageMEM();
+    void stageWB();
+    // Load/store of one EX/MEM latch into its MEM/WB latch, and its write back
+    void accessMemory(const PipelineRegister& from, PipelineRegister& to);
+    void writeBack(const PipelineRegister& latch);
+    // Train the predictors with a resolved branch or jump and count it.
+    // Returns true if fetch followed the wrong path, penalty is the number
+    // of wrong-path fetches the resolving stage flushes.
+    bool resolveBranch(const PipelineRegister& branch, bool taken, uint32_t target, int penalty);
+    // Count the stages that start this cycle without an instruction
+    void beginCycle() {
+        counters.bubbles[BUBBLE_ID] += !ifId.valid;
+        counters.bubbles[BUBBLE_EX] += !idEx.valid;
+        counters.bubbles[BUBBLE_MEM] += !exMem.valid;
+        counters.bubbles[BUBBLE_WB] += !memWb.valid;
+    }
+    // Bookkeeping after the stages of a cycle ran, and at the end of run()
+    void endCycle();
+    void finishRun();
+    // Write out the streamed diagram window that the last cycle completed
+    void streamCompletedWindow();
+    // Put the instruction at pc in IF for cycle 0
+    void seedFetch();
+    // Drop the diagram cells recorded so far and seed it again at pc
+    void reseedFetch();
     // Update pipeline table with current state
     void updatePipelineTable();
-    // Helper to add or update instruction in table
-    void updateOrAddInstruction(const string& assembly, const string& stage);
-    // New method to update instruction stage based on PC
-    void updateInstructionStage(uint32_t pc, const string& stage);
+    // Update instruction stage based on PC (O(1), indexed by (pc - textBase)/4),
+    // sub is the sub-stage, 0 for the first one
+    void updateInstructionStage(uint32_t pc, Stage stage, int sub = 0);
+    // Bit of a sub-stage in a cell, the classic pipeline uses bits 0 to 4
+    uint16_t stageBit(Stage stage, int sub) const;
+    // Text for a cell's stage mask, e.g. "MEM/IF" or "-". Sub-stages are
+    // numbered (IF1/IF2) when their stage has more than one.
+    const string& stageText(uint16_t stages) const;
+    mutable vector<string> stageTexts; // formatted on first use, indexed by mask
+    // Format cycles [from, to) of the given rows into out
+    void formatDiagram(string& out, int from, int to, const vector<uint32_t>& rows,
+                       size_t maxStageLength) const;
+    static void appendPadded(string& out, const string& text, size_t width);
+    // Write out a completed window in streaming mode and evict its cells
+    void flushStreamWindow(int to);
     // Helper function to strip comments from assembly code
-    string stripComments(const string& assembly);
-    
-    
+    static string stripComments(string_view assembly);
+    // State a variant has besides the latches above, saved after them
+    virtual void saveVariantState(CheckpointWriter&, bool /*includeTracker*/) const {}
+    virtual void restoreVariantState(CheckpointReader&) {}
+    // Counters of the variant's own structures, appended to the JSON object
+    virtual void writeVariantJson(ostream&) const {}
+
+
 public:
     Processor();
     virtual ~Processor() = default;
     // Initialize the processor with instructions from a file
     void loadProgram(const string& filename);
+    // Same with an already loaded image, which may be shared between processors
+    void loadProgram(shared_ptr<const ProgramImage> image);
+    // Execute count instructions functionally (no timing, no diagram) and
+    // start the pipeline from the resulting state, call before run()
+    void fastForward(uint64_t count);
     // Run the simulation for specified number of cycles
-    void run(int cycles);
+    virtual void run(int cycles) = 0;
+    // Run cycles without the end-of-run output, for running in slices.
+    // run(cycles) is simulate(cycles) plus the output, so run(0) prints it.
+    virtual void simulate(int cycles) = 0;
+    // Write the diagram to out instead of cout, out must outlive the run
+    void setOutput(ostream& out) { output = &out; }
+    // Predict conditional branches with this predictor (default not-taken)
+    void setBranchPredictor(unique_ptr<BranchPredictor> newPredictor) { predictor = move(newPredictor); }
+    // Predict jump targets with a BTB of this many entries (0 = none)
+    void setBtbSize(uint32_t entries) { btb = BranchTargetBuffer(entries); }
+    // Prediction accuracy and the cycles lost to flushes
+    void printBranchStats(ostream& out) const;
+    // Hits, misses and stall cycles of the enabled caches
+    void printCacheStats(ostream& out) const;
+    // Anything else a variant reports with --stats
+    virtual void printVariantStats(ostream&) const {}
+    // Split IF, EX and MEM into sub-stages, call before run()
+    virtual void setPipelineDepth(const PipelineDepth& newDepth);
+    // Stop at ecall/ebreak or once the pipeline drained past the end of the
+    // program, the cycle count of run() is then only a limit
+    void setHaltEnabled(bool enabled) { haltEnabled = enabled; }
+    bool isHalted() const { return haltReason != HaltReason::NONE; }
+    // How a --halt run ended, with the final cycle count and exit code
+    void printHaltReport(ostream& out) const;
+    // Exit status of the program: a0 at ecall/ebreak, 0 otherwise
+    int getExitStatus() const { return haltReason == HaltReason::ECALL || haltReason == HaltReason::EBREAK ? exitCode : 0; }
+    // Hart number csrr mhartid reads (default 0)
+    virtual void setHartId(uint32_t id) { hartId = id; }
+    // Read through to a memory shared with other harts, stores stay private
+    // until commitStores(), call after loadProgram()
+    void shareMemory(Memory& shared) { memory.attach(shared); }
+    void commitStores() { memory.commitStores(); }
+    size_t getBufferedStores() const { return memory.getBufferedStores(); }
+    // Latencies of the multiplier (pipelined) and the divider (blocking)
+    void setUnitLatencies(int multiply, int divide) { mulLatency = multiply; divLatency = divide; }
+    // Model L1 caches with these parameters in front of Memory
+    void setInstructionCache(const Cache::Config& config) { icache = Cache(config); }
+    void setDataCache(const Cache::Config& config) { dcache = Cache(config); }
+    // All counters as one JSON object on a single line, without a newline
+    void writeCountersJson(ostream& out) const;
+    // Skip the pipeline diagram, only the counters are kept
+    void setDiagramEnabled(bool enabled) { diagramEnabled = enabled; }
+    // Stream the diagram in windows of this many cycles (0 = print at the end)
+    void setStreamWindow(int cycles);
+    // Throw on misaligned loads/stores instead of splitting them into bytes
+    void setMisalignedTrap(bool enabled) { memory.setMisalignedTrap(enabled); }
+    uint64_t getMisalignedAccesses() const { return memory.getMisalignedAccesses(); }
+    // Cycles simulated so far, a checkpoint's included
+    int getCycleCount() const { return cycleCount; }
+    // Number of instructions in the loaded program
+    size_t getProgramSize() const { return memory.getInstructionCount(); }
     // Reset processor state
     void reset();
     // Print the complete pipeline diagram
     void printPipelineDiagram();
+    
+    // Write the complete state to a binary checkpoint file. Without the
+    // tracker only the last cycle of the diagram is kept, a restored run then
+    // prints from the checkpoint cycle on.
+    void saveCheckpoint(const string& filename, bool includeTracker) const;
+    // Continue from a checkpoint of the same program, call after loadProgram()
+    void loadCheckpoint(const string& filename);
 };
@@ -0,0 +1,8 @@
+#pragma once
+#include "Processor.hpp"
+#include <memory>
+#include <string>
+using namespace std;
+// Processor variant by name ("forward", "noforward", "dualissue", "outoforder"), nullptr if unknown.
+// The simulator binaries pick it from their own name, simbatch per job.
+unique_ptr<Processor> createProcessor(const string& variant);
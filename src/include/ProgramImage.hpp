@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Instruction.hpp"
+#include "MappedFile.hpp"
+using namespace std;
+
+// Immutable, predecoded program: the instruction image indexed by
+// (pc - textBase)/4, its assembly side table and the initial contents of
+// data memory. Built once per file, it is never modified afterwards.
+class ProgramImage {
+public:
+    enum class Format { TEXT, BINARY, ELF };
+    
+    // Bytes copied into data memory at load time, zero-filled up to memorySize
+    struct Segment {
+        uint32_t address;
+        string_view bytes;
+        uint32_t memorySize;
+    };
+    
+private:
+    Format format;
+    MappedFile file;
+    uint32_t textBase;
+    uint32_t entryPoint;
+    vector<Instruction> instructions;
+    // Assembly text, views into the mapped file (text format) or generatedText
+    vector<string_view> assembly;
+    string generatedText;
+    vector<Segment> segments;
+    
+    void parseText(const string& filename);
+    void parseBinary(const string& filename);
+    void parseElf(const string& filename);
+    // decode words from raw bytes and disassemble them for the side table
+    void decodeWords(const uint8_t* bytes, size_t count);
+    
+    static const Instruction nopInstruction;
+    
+public:
+    ProgramImage();
+    
+    // Load a "<hex> <assembly>" text file, an RV32 ELF executable or a flat
+    // .bin image (loaded at address 0). ELF is detected by its magic number.
+    static shared_ptr<const ProgramImage> load(const string& filename);
+    
+    Format getFormat() const { return format; }
+    uint32_t getTextBase() const { return textBase; }
+    uint32_t getEntryPoint() const { return entryPoint; }
+    size_t getInstructionCount() const { return instructions.size(); }
+    const vector<Segment>& getSegments() const { return segments; }
+    
+    // true if pc is inside the instruction image
+    bool contains(uint32_t pc) const {
+        return (pc - textBase) / 4 < instructions.size();
+    }
+    // Pointer into the image, NOP outside of it
+    const Instruction* getInstruction(uint32_t pc) const {
+        size_t index = (pc - textBase) / 4;
+        return index < instructions.size() ? &instructions[index] : &nopInstruction;
+    }
+    string_view getAssembly(uint32_t pc) const;
+    
+    // FNV-1a hash of the layout, instructions and initial data, used to
+    // check that a checkpoint belongs to this program
+    uint64_t fingerprint() const;
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include "Checkpoint.hpp"
 using namespace std;
 
 class RegisterFile {
@@ -17,4 +18,8 @@ public:
     
     // Reset all registers to 0
     void reset();
+    
+    // Checkpoint support
+    void saveState(CheckpointWriter& out) const;
+    void restoreState(CheckpointReader& in);
 };
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+using namespace std;
+// Fixed set of worker threads, each with its own task queue. A worker runs
+// its own queue newest first and, when that is empty, steals the oldest
+// task of another worker, so long jobs don't leave the other cores idle.
+class WorkStealingPool {
+public:
+    using Task = function<void()>;
+    
+private:
+    struct Queue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> threads;
+    
+    atomic<size_t> queued;             // tasks sitting in a queue
+    atomic<size_t> pending;            // tasks submitted but not finished
+    size_t nextQueue;                  // round-robin target of submit()
+    bool stopping;
+    mutex idleLock;
+    condition_variable wakeUp;         // workers: new task or stopping
+    condition_variable finished;       // wait(): pending reached 0
+    
+    bool take(size_t self, Task& task);
+    void workerLoop(size_t self);
+    
+public:
+    explicit WorkStealingPool(size_t threadCount);
+    ~WorkStealingPool();
+    
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    
+    // Queue a task, tasks must not throw
+    void submit(Task task);
+    // Block until every submitted task has finished
+    void wait();
+    
+    size_t getThreadCount() const { return threads.size(); }
+};
@@ -0,0 +1,76 @@
+#include "../include/ALU.hpp"
+#include <utility>
+using namespace std;
+
+namespace {
+
+const char* const names[] = {
+    "none",
+    "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+    "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+    "link", "lui", "auipc", "hartid"
+};
+
+template <size_t... OPS>
+constexpr array<ALU::Function, sizeof...(OPS)> makeTable(index_sequence<OPS...>) {
+    return {{&ALU::apply<static_cast<AluOp>(OPS)>...}};
+}
+
+} // namespace
+
+// one instantiation of ALU::apply per AluOp, in enum order
+const array<ALU::Function, ALU::OP_COUNT> ALU::table = makeTable(make_index_sequence<OP_COUNT>());
+
+const array<ALU::Condition, 8> ALU::conditions = {{
+    &condition<0>, &condition<1>, &condition<2>, &condition<3>,
+    &condition<4>, &condition<5>, &condition<6>, &condition<7>
+}};
+
+AluOp ALU::resolve(int opcode, int funct3, int funct7, int32_t imm) {
+    static const AluOp mulOps[8] = {AluOp::MUL, AluOp::MULH, AluOp::MULHSU, AluOp::MULHU,
+                                    AluOp::DIV, AluOp::DIVU, AluOp::REM, AluOp::REMU};
+    static const AluOp regOps[8] = {AluOp::ADD, AluOp::SLL, AluOp::SLT, AluOp::SLTU,
+                                    AluOp::XOR, AluOp::SRL, AluOp::OR, AluOp::AND};
+    static const AluOp immOps[8] = {AluOp::ADDI, AluOp::SLLI, AluOp::SLTI, AluOp::SLTIU,
+                                    AluOp::XORI, AluOp::SRLI, AluOp::ORI, AluOp::ANDI};
+    switch (opcode) {
+        case 0x33: // R-type
+            if (funct7 == 0x01) {
+                return mulOps[funct3];
+            }
+            if (funct3 == 0x0 || funct3 == 0x5) {
+                // add/sub and srl/sra need an exact funct7, anything else does nothing
+                if (funct7 == 0x00) return regOps[funct3];
+                if (funct7 == 0x20) return funct3 == 0x0 ? AluOp::SUB : AluOp::SRA;
+                return AluOp::NONE;
+            }
+            return regOps[funct3];
+        case 0x13: // immediate ALU, imm[11:5] != 0 selects srai
+            if (funct3 == 0x5 && (imm >> 5) != 0) {
+                return AluOp::SRAI;
+            }
+            return immOps[funct3];
+        case 0x03: // loads and stores compute rs1 + imm
+        case 0x23:
+            return AluOp::ADDI;
+        case 0x6F: // jal/jalr write pc + 4
+        case 0x67:
+            return AluOp::LINK;
+        case 0x37:
+            return AluOp::LUI;
+        case 0x17:
+            return AluOp::AUIPC;
+        case 0x73: // csrrs rd, mhartid, x0
+            return funct3 == 0x2 && imm == 0xF14 ? AluOp::HARTID : AluOp::NONE;
+        default:
+            return AluOp::NONE;
+    }
+}
+
+const char* ALU::name(AluOp op) {
+    static_assert(sizeof(names) / sizeof(names[0]) == OP_COUNT,
+                  "one name per AluOp");
+    size_t index = static_cast<size_t>(op);
+    return index < OP_COUNT ? names[index] : "?";
+}
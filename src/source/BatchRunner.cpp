@@ -0,0 +1,175 @@
+#include "../include/BatchRunner.hpp"
+#include "../include/ProcessorFactory.hpp"
+#include "../include/WorkStealingPool.hpp"
+#include "../include/MappedFile.hpp"
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+BatchRunner::BatchRunner(const string& expectedDir) : expectedDir(expectedDir) {
+}
+
+void BatchRunner::loadManifest(const string& filename) {
+    ifstream in(filename);
+    if (!in) {
+        throw runtime_error("Could not open manifest: " + filename);
+    }
+    string text;
+    int lineNumber = 0;
+    while (getline(in, text)) {
+        lineNumber++;
+        size_t comment = text.find('#');
+        if (comment != string::npos) {
+            text.erase(comment);
+        }
+        istringstream fields(text);
+        Job job;
+        job.line = lineNumber;
+        if (!(fields >> job.inputFile)) {
+            continue; // blank line
+        }
+        if (!(fields >> job.variant >> job.cycles) || job.cycles <= 0) {
+            throw runtime_error(filename + ":" + to_string(lineNumber) +
+                                ": expected <input file> <variant> <cycles> [output file]");
+        }
+        fields >> job.outputFile;
+        jobs.push_back(job);
+    }
+}
+
+void BatchRunner::loadImages() {
+    // decode every input once, jobs only share the immutable images
+    for (const Job& job : jobs) {
+        if (images.count(job.inputFile) || loadErrors.count(job.inputFile)) {
+            continue;
+        }
+        try {
+            images[job.inputFile] = ProgramImage::load(job.inputFile);
+        } catch (const exception& e) {
+            loadErrors[job.inputFile] = e.what();
+        }
+    }
+}
+
+BatchRunner::Result BatchRunner::runJob(const Job& job) const {
+    Result result;
+    auto error = loadErrors.find(job.inputFile);
+    if (error != loadErrors.end()) {
+        result.message = error->second;
+        return result;
+    }
+    unique_ptr<Processor> processor = createProcessor(job.variant);
+    if (!processor) {
+        result.message = "unknown variant '" + job.variant + "'";
+        return result;
+    }
+    
+    ostringstream diagram;
+    processor->setOutput(diagram);
+    processor->loadProgram(images.at(job.inputFile));
+    processor->run(job.cycles);
+    const string text = diagram.str();
+    ostringstream counters;
+    processor->writeCountersJson(counters);
+    result.counters = counters.str();
+    
+    if (!job.outputFile.empty()) {
+        ofstream out(job.outputFile, ios::binary | ios::trunc);
+        if (!out.write(text.data(), text.size())) {
+            result.message = "could not write " + job.outputFile;
+            return result;
+        }
+        result.status = Status::WRITTEN;
+        result.message = job.outputFile;
+        return result;
+    }
+    
+    // compare in memory with outputfiles/expected/<variant>_<name>.txt
+    string name = job.inputFile.substr(job.inputFile.find_last_of("/\\") + 1);
+    string expectedFile = expectedDir + "/" + job.variant + "_" + name;
+    MappedFile expected;
+    try {
+        expected = MappedFile(expectedFile);
+    } catch (const exception&) {
+        result.status = Status::NO_EXPECTED;
+        result.message = expectedFile;
+        return result;
+    }
+    string_view want = expected.view();
+    if (want == text) {
+        result.status = Status::PASSED;
+        return result;
+    }
+    
+    // report the first line that differs
+    size_t at = 0;
+    while (at < want.size() && at < text.size() && want[at] == text[at]) {
+        at++;
+    }
+    size_t line = 1 + count(text.begin(), text.begin() + at, '\n');
+    result.status = Status::FAILED;
+    result.message = "differs from " + expectedFile + " at line " + to_string(line);
+    return result;
+}
+
+void BatchRunner::run(size_t threadCount) {
+    loadImages();
+    results.assign(jobs.size(), Result());
+    WorkStealingPool pool(threadCount);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.submit([this, i] {
+            try {
+                results[i] = runJob(jobs[i]);
+            } catch (const exception& e) {
+                results[i].status = Status::ERROR;
+                results[i].message = e.what();
+            }
+        });
+    }
+    pool.wait();
+}
+
+size_t BatchRunner::report(ostream& out) const {
+    static const char* labels[] = {"PASS", "FAIL", "WROTE", "NOEXP", "ERROR"};
+    size_t failed = 0;
+    size_t counts[5] = {0, 0, 0, 0, 0};
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Job& job = jobs[i];
+        const Result& result = results[i];
+        int status = static_cast<int>(result.status);
+        counts[status]++;
+        failed += result.status == Status::FAILED || result.status == Status::ERROR;
+        out << labels[status] << "  " << job.variant << " " << job.inputFile << " " << job.cycles;
+        if (!result.message.empty()) {
+            out << "  (" << result.message << ")";
+        }
+        out << "\n";
+    }
+    out << jobs.size() << " jobs: " << counts[0] << " passed, " << counts[1] << " failed, "
+        << counts[2] << " written, " << counts[3] << " without expected output, "
+        << counts[4] << " errors\n";
+    return failed;
+}
+
+// JSON string literal for a file name
+static string jsonString(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+void BatchRunner::writeJson(ostream& out) const {
+    static const char* labels[] = {"pass", "fail", "written", "no-expected", "error"};
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Result& result = results[i];
+        out << "{\"input\": " << jsonString(jobs[i].inputFile)
+            << ", \"variant\": " << jsonString(jobs[i].variant)
+            << ", \"status\": \"" << labels[static_cast<int>(result.status)] << "\""
+            << ", \"counters\": " << (result.counters.empty() ? "null" : result.counters) << "}\n";
+    }
+}
@@ -0,0 +1,116 @@
+#include "../include/BranchPredictor.hpp"
+#include <stdexcept>
+using namespace std;
+
+// table sizes must be powers of two so the index is a mask
+static uint32_t roundToPowerOfTwo(uint32_t entries) {
+    uint32_t size = 1;
+    while (size < entries) {
+        size <<= 1;
+    }
+    return size;
+}
+
+BimodalPredictor::BimodalPredictor(uint32_t entries)
+    : counters(roundToPowerOfTwo(entries), 1), mask(roundToPowerOfTwo(entries) - 1) {
+    // start weakly not taken
+}
+
+void BimodalPredictor::train(uint32_t index, bool taken) {
+    uint8_t& counter = counters[index & mask];
+    if (taken && counter < 3) {
+        counter++;
+    } else if (!taken && counter > 0) {
+        counter--;
+    }
+}
+
+bool BimodalPredictor::predict(uint32_t pc, int32_t) {
+    return counters[(pc >> 2) & mask] >= 2;
+}
+
+void BimodalPredictor::update(uint32_t pc, bool taken) {
+    train(pc >> 2, taken);
+}
+
+void BimodalPredictor::saveState(CheckpointWriter& out) const {
+    out.putBytes(counters.data(), counters.size());
+}
+
+void BimodalPredictor::restoreState(CheckpointReader& in) {
+    in.getBytes(counters.data(), counters.size());
+}
+
+GsharePredictor::GsharePredictor(uint32_t historyBits)
+    : BimodalPredictor(1u << historyBits), history(0) {
+}
+
+bool GsharePredictor::predict(uint32_t pc, int32_t) {
+    return counters[((pc >> 2) ^ history) & mask] >= 2;
+}
+
+void GsharePredictor::update(uint32_t pc, bool taken) {
+    train((pc >> 2) ^ history, taken);
+    history = ((history << 1) | (taken ? 1 : 0)) & mask;
+}
+
+void GsharePredictor::saveState(CheckpointWriter& out) const {
+    BimodalPredictor::saveState(out);
+    out.put(history);
+}
+
+void GsharePredictor::restoreState(CheckpointReader& in) {
+    BimodalPredictor::restoreState(in);
+    history = in.get<uint32_t>();
+}
+
+BranchTargetBuffer::BranchTargetBuffer(uint32_t size)
+    : entries(size == 0 ? 0 : roundToPowerOfTwo(size), Entry{0, 0, false}) {
+}
+
+bool BranchTargetBuffer::lookup(uint32_t pc, uint32_t& target) const {
+    if (entries.empty()) {
+        return false;
+    }
+    const Entry& entry = entries[(pc >> 2) & (entries.size() - 1)];
+    if (!entry.valid || entry.pc != pc) {
+        return false;
+    }
+    target = entry.target;
+    return true;
+}
+
+void BranchTargetBuffer::update(uint32_t pc, uint32_t target) {
+    if (entries.empty()) {
+        return;
+    }
+    entries[(pc >> 2) & (entries.size() - 1)] = Entry{pc, target, true};
+}
+
+void BranchTargetBuffer::saveState(CheckpointWriter& out) const {
+    out.put(static_cast<uint32_t>(entries.size()));
+    out.putBytes(entries.data(), entries.size() * sizeof(Entry));
+}
+
+void BranchTargetBuffer::restoreState(CheckpointReader& in) {
+    if (in.get<uint32_t>() != entries.size()) {
+        throw runtime_error("Checkpoint was taken with a different BTB size: " + in.getFilename());
+    }
+    in.getBytes(entries.data(), entries.size() * sizeof(Entry));
+}
+
+unique_ptr<BranchPredictor> createBranchPredictor(const string& name) {
+    if (name == "not-taken") {
+        return make_unique<NotTakenPredictor>();
+    }
+    if (name == "btfn") {
+        return make_unique<BtfnPredictor>();
+    }
+    if (name == "bimodal") {
+        return make_unique<BimodalPredictor>();
+    }
+    if (name == "gshare") {
+        return make_unique<GsharePredictor>();
+    }
+    return nullptr;
+}
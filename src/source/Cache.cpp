@@ -0,0 +1,221 @@
+#include "../include/Cache.hpp"
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+static bool isPowerOfTwo(uint32_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+// size with an optional k/m suffix
+static uint32_t parseSize(const string& key, const string& text) {
+    size_t used = 0;
+    unsigned long value = 0;
+    try {
+        value = stoul(text, &used);
+    } catch (const exception&) {
+        throw runtime_error("bad value for " + key + ": " + text);
+    }
+    string suffix = text.substr(used);
+    if (suffix == "k" || suffix == "K") {
+        value <<= 10;
+    } else if (suffix == "m" || suffix == "M") {
+        value <<= 20;
+    } else if (!suffix.empty()) {
+        throw runtime_error("bad value for " + key + ": " + text);
+    }
+    return static_cast<uint32_t>(value);
+}
+
+Cache::Config Cache::Config::parse(const string& spec) {
+    Config config;
+    stringstream fields(spec);
+    string field;
+    while (getline(fields, field, ',')) {
+        if (field.empty()) {
+            continue;
+        }
+        size_t equals = field.find('=');
+        if (equals == string::npos) {
+            throw runtime_error("expected key=value, got " + field);
+        }
+        string key = field.substr(0, equals);
+        string value = field.substr(equals + 1);
+        if (key == "size") {
+            config.size = parseSize(key, value);
+        } else if (key == "line") {
+            config.lineSize = parseSize(key, value);
+        } else if (key == "ways") {
+            config.ways = parseSize(key, value);
+        } else if (key == "latency") {
+            config.missLatency = parseSize(key, value);
+        } else if (key == "repl") {
+            if (value == "lru") {
+                config.replacement = Replacement::LRU;
+            } else if (value == "plru") {
+                config.replacement = Replacement::PLRU;
+            } else if (value == "random") {
+                config.replacement = Replacement::RANDOM;
+            } else {
+                throw runtime_error("repl must be lru, plru or random");
+            }
+        } else if (key == "write") {
+            if (value == "back") {
+                config.writePolicy = WritePolicy::WRITE_BACK;
+            } else if (value == "through") {
+                config.writePolicy = WritePolicy::WRITE_THROUGH;
+            } else {
+                throw runtime_error("write must be back or through");
+            }
+        } else {
+            throw runtime_error("unknown cache parameter " + key);
+        }
+    }
+    
+    // sets and lines are indexed with masks
+    if (!isPowerOfTwo(config.lineSize) || config.lineSize < 4) {
+        throw runtime_error("line size must be a power of two of at least 4 bytes");
+    }
+    if (config.ways == 0 || config.size % (config.lineSize * config.ways) != 0 ||
+        !isPowerOfTwo(config.size / (config.lineSize * config.ways))) {
+        throw runtime_error("size must be a power-of-two number of sets of ways * line bytes");
+    }
+    if (config.replacement == Replacement::PLRU && (!isPowerOfTwo(config.ways) || config.ways > 32)) {
+        throw runtime_error("plru needs a power-of-two number of ways up to 32");
+    }
+    return config;
+}
+
+Cache::Cache() : setCount(0), offsetBits(0), useClock(0), randomState(1), hits(0), misses(0), writeBacks(0) {
+}
+
+Cache::Cache(const Config& config) : Cache() {
+    this->config = config;
+    setCount = config.size / (config.lineSize * config.ways);
+    while ((1u << offsetBits) < config.lineSize) {
+        offsetBits++;
+    }
+    lines.assign(setCount * config.ways, Line{0, 0, false, false});
+    treeBits.assign(setCount, 0);
+}
+
+uint32_t Cache::victim(uint32_t set) {
+    Line* ways = &lines[set * config.ways];
+    // an empty way first
+    for (uint32_t way = 0; way < config.ways; way++) {
+        if (!ways[way].valid) {
+            return way;
+        }
+    }
+    switch (config.replacement) {
+        case Replacement::LRU: {
+            uint32_t oldest = 0;
+            for (uint32_t way = 1; way < config.ways; way++) {
+                if (ways[way].lastUse < ways[oldest].lastUse) {
+                    oldest = way;
+                }
+            }
+            return oldest;
+        }
+        case Replacement::PLRU: {
+            // follow the tree bits, each points away from the recently used half
+            uint32_t node = 0;
+            uint32_t bits = treeBits[set];
+            while (node < config.ways - 1) {
+                node = 2 * node + 1 + ((bits >> node) & 1);
+            }
+            return node - (config.ways - 1);
+        }
+        default:
+            // xorshift, deterministic so runs are reproducible
+            randomState ^= randomState << 13;
+            randomState ^= randomState >> 17;
+            randomState ^= randomState << 5;
+            return randomState % config.ways;
+    }
+}
+
+void Cache::touch(uint32_t set, uint32_t way) {
+    lines[set * config.ways + way].lastUse = ++useClock;
+    if (config.replacement == Replacement::PLRU) {
+        // point every node on the path to the other half
+        uint32_t node = way + config.ways - 1;
+        uint32_t& bits = treeBits[set];
+        while (node > 0) {
+            uint32_t parent = (node - 1) / 2;
+            bool cameFromLeft = node == 2 * parent + 1;
+            if (cameFromLeft) {
+                bits |= 1u << parent;
+            } else {
+                bits &= ~(1u << parent);
+            }
+            node = parent;
+        }
+    }
+}
+
+uint32_t Cache::access(uint32_t addr, bool write) {
+    uint32_t lineNumber = addr >> offsetBits;
+    uint32_t set = lineNumber & (setCount - 1);
+    uint32_t tag = lineNumber / setCount;
+    Line* ways = &lines[set * config.ways];
+    bool writeBack = config.writePolicy == WritePolicy::WRITE_BACK;
+    
+    for (uint32_t way = 0; way < config.ways; way++) {
+        if (ways[way].valid && ways[way].tag == tag) {
+            hits++;
+            ways[way].dirty |= write && writeBack;
+            touch(set, way);
+            return 0;
+        }
+    }
+    
+    misses++;
+    if (write && !writeBack) {
+        // no allocation, the write buffer hides the store
+        return 0;
+    }
+    uint32_t way = victim(set);
+    uint32_t latency = config.missLatency;
+    if (ways[way].valid && ways[way].dirty) {
+        writeBacks++;
+        latency += config.missLatency;
+    }
+    ways[way] = Line{tag, 0, true, write && writeBack};
+    touch(set, way);
+    return latency;
+}
+
+void Cache::saveState(CheckpointWriter& out) const {
+    out.put(static_cast<uint32_t>(lines.size()));
+    for (const Line& line : lines) {
+        out.put(line.tag);
+        out.put(line.lastUse);
+        out.put(line.valid);
+        out.put(line.dirty);
+    }
+    out.putBytes(treeBits.data(), treeBits.size() * sizeof(uint32_t));
+    out.put(useClock);
+    out.put(randomState);
+    out.put(hits);
+    out.put(misses);
+    out.put(writeBacks);
+}
+
+void Cache::restoreState(CheckpointReader& in) {
+    if (in.get<uint32_t>() != lines.size()) {
+        throw runtime_error("Checkpoint was taken with a different cache configuration: " + in.getFilename());
+    }
+    for (Line& line : lines) {
+        line.tag = in.get<uint32_t>();
+        line.lastUse = in.get<uint64_t>();
+        line.valid = in.get<bool>();
+        line.dirty = in.get<bool>();
+    }
+    in.getBytes(treeBits.data(), treeBits.size() * sizeof(uint32_t));
+    useClock = in.get<uint64_t>();
+    randomState = in.get<uint32_t>();
+    hits = in.get<uint64_t>();
+    misses = in.get<uint64_t>();
+    writeBacks = in.get<uint64_t>();
+}
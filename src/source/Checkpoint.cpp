@@ -0,0 +1,32 @@
+#include "../include/Checkpoint.hpp"
+#include <fstream>
+#include <cstring>
+using namespace std;
+
+void CheckpointWriter::putBytes(const void* data, size_t size) {
+    buffer.append(static_cast<const char*>(data), size);
+}
+
+void CheckpointWriter::save(const string& filename) const {
+    ofstream out(filename, ios::binary | ios::trunc);
+    if (!out.write(buffer.data(), buffer.size())) {
+        throw runtime_error("Could not write checkpoint file: " + filename);
+    }
+}
+
+CheckpointReader::CheckpointReader(const string& filename)
+    : filename(filename), file(filename), data(file.view()), offset(0) {
+}
+
+string_view CheckpointReader::getView(size_t size) {
+    if (size > data.size() - offset) {
+        throw runtime_error("Truncated checkpoint file: " + filename);
+    }
+    string_view view = data.substr(offset, size);
+    offset += size;
+    return view;
+}
+
+void CheckpointReader::getBytes(void* out, size_t size) {
+    memcpy(out, getView(size).data(), size);
+}
@@ -0,0 +1,360 @@
+#include "../include/DualIssueProcessor.hpp"
+using namespace std;
+
+// true if the instruction reads reg as a source operand
+static bool readsRegister(const Instruction& instr, int reg) {
+    if (instr.isUType() || instr.isJType()) {
+        return false;
+    }
+    return instr.getRs1() == reg || (!instr.isIType() && instr.getRs2() == reg);
+}
+
+DualIssueProcessor::DualIssueProcessor() : issueCount(0), fetchedPcs{0, 0}, fetchedCount(0) {
+    variantName = "dualissue";
+    issueWidth = 2;
+}
+
+void DualIssueProcessor::beginCycle() {
+    // every empty slot counts, a stage can have two bubbles per cycle
+    Processor::beginCycle();
+    counters.bubbles[BUBBLE_ID] += !ifId2.valid;
+    counters.bubbles[BUBBLE_EX] += !idEx2.valid;
+    counters.bubbles[BUBBLE_MEM] += !exMem2.valid;
+    counters.bubbles[BUBBLE_WB] += !memWb2.valid;
+}
+
+void DualIssueProcessor::endCycle() {
+    // fetches show in the cycle they started, the latches hold the stages
+    // of the next cycle like in Processor::endCycle
+    if (diagramEnabled) {
+        for (int i = 0; i < fetchedCount; i++) {
+            if (memory.isInstructionAddress(fetchedPcs[i])) {
+                updateInstructionStage(fetchedPcs[i], STAGE_IF);
+            }
+        }
+    }
+    fetchedCount = 0;
+    cycleCount++;
+    if (!diagramEnabled) {
+        return;
+    }
+    updatePipelineTable();
+    streamCompletedWindow();
+}
+
+void DualIssueProcessor::stageIF() {
+    // redirected in EX this cycle, the pending fetch is dropped and the
+    // group is fetched from the resolved pc next cycle
+    if (tibt) {
+        tibt = false;
+        pc = btpc;
+        fetchWait = 0;
+        fetchStarted = false;
+        return;
+    }
+    // --halt: nothing is fetched past the end of the program
+    if (haltEnabled && !memory.isInstructionAddress(pc)) {
+        fetchPastEnd();
+        return;
+    }
+    
+    // refill the slots ID freed, oldest first
+    if (!ifId.valid && !fetchInto(ifId)) {
+        return;
+    }
+    if (!ifId2.valid) {
+        fetchInto(ifId2);
+    }
+}
+
+bool DualIssueProcessor::fetchInto(PipelineRegister& slot) {
+    if (haltEnabled && !memory.isInstructionAddress(pc)) {
+        return false;
+    }
+    if (!fetchStarted) {
+        fetchedPcs[fetchedCount++] = pc;
+    }
+    if (icache.enabled() && waitForFetch()) {
+        return false;
+    }
+    
+    slot.valid = true;
+    slot.instruction = *memory.getInstruction(pc);
+    slot.pc = pc;
+    pc += 4;
+    fetchStarted = false;
+    
+    // follow the predicted path, a fetch group ends at a predicted taken branch
+    const Instruction& instr = slot.instruction;
+    slot.predictedTaken = false;
+    if (instr.isBType()) {
+        if (predictor->predict(slot.pc, instr.getImm())) {
+            slot.predictedTaken = true;
+            slot.predictedTarget = slot.pc + instr.getImm();
+        }
+    } else if (instr.isJump()) {
+        slot.predictedTaken = btb.lookup(slot.pc, slot.predictedTarget);
+    }
+    if (slot.predictedTaken) {
+        pc = slot.predictedTarget;
+        return false;
+    }
+    return true;
+}
+
+bool DualIssueProcessor::mustWait(const Instruction& instr) const {
+    // a load in either EX slot can't forward to the next cycle's EX
+    for (const PipelineRegister* ex : {&idEx, &idEx2}) {
+        if (ex->valid && ex->instruction.isLoad() && ex->instruction.writesRd() &&
+            readsRegister(instr, ex->instruction.getRd())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DualIssueProcessor::canPair(const Instruction& older, const Instruction& younger) {
+    // one memory port, one branch unit and one multiplier/divider
+    bool olderMemory = older.isLoad() || older.isSType();
+    bool youngerMemory = younger.isLoad() || younger.isSType();
+    bool olderControl = older.isBType() || older.isJump();
+    bool youngerControl = younger.isBType() || younger.isJump();
+    AluOp olderOp = older.getAluOp();
+    AluOp youngerOp = younger.getAluOp();
+    bool olderMulDiv = ALU::isMultiply(olderOp) || ALU::isDivide(olderOp);
+    bool youngerMulDiv = ALU::isMultiply(youngerOp) || ALU::isDivide(youngerOp);
+    if ((olderMemory && youngerMemory) || (olderControl && youngerControl) || (olderMulDiv && youngerMulDiv)) {
+        return false;
+    }
+    // nothing forwards between the slots of one EX cycle
+    return !(older.writesRd() && readsRegister(younger, older.getRd()));
+}
+
+void DualIssueProcessor::detectHazards() {
+    stall = false;
+    issueCount = 0;
+    if (!ifId.valid) {
+        return;
+    }
+    
+    // the older instruction stalls the whole group
+    const Instruction& older = ifId.instruction;
+    if (mustWait(older)) {
+        stall = true;
+        counters.stalls[STALL_LOAD_USE]++;
+        return;
+    }
+    if (waitsForMultiplier(older)) {
+        stall = true;
+        counters.stalls[STALL_MULTIPLY]++;
+        return;
+    }
+    issueCount = 1;
+    if (!ifId2.valid) {
+        return;
+    }
+    
+    // the younger one goes along unless a pairing rule or a hazard holds it
+    const Instruction& younger = ifId2.instruction;
+    if (canPair(older, younger) && !mustWait(younger) && !waitsForMultiplier(younger)) {
+        issueCount = 2;
+        counters.dualIssues++;
+    } else {
+        counters.splitIssues++;
+    }
+}
+
+void DualIssueProcessor::stageID() {
+    // slots that don't issue send a bubble to EX, registers are read in EX
+    const PipelineRegister* from[2] = {&ifId, &ifId2};
+    PipelineRegister* to[2] = {&idEx, &idEx2};
+    for (int i = 0; i < 2; i++) {
+        if (i >= issueCount) {
+            to[i]->clear();
+            continue;
+        }
+        const Instruction& instr = from[i]->instruction;
+        to[i]->instruction = instr;
+        to[i]->pc = from[i]->pc;
+        to[i]->valid = true;
+        to[i]->predictedTaken = from[i]->predictedTaken;
+        to[i]->predictedTarget = from[i]->predictedTarget;
+        to[i]->isBType = instr.isBType() || instr.isJump();
+    }
+    
+    // what stays in ID moves up to the older slot
+    if (issueCount == 2) {
+        ifId.clear();
+        ifId2.clear();
+    } else if (issueCount == 1) {
+        ifId = ifId2;
+        ifId2.clear();
+    }
+}
+
+void DualIssueProcessor::stageEX() {
+    if (!idEx.valid) {
+        exMem.clear();
+        exMem2.clear();
+        return;
+    }
+    // the divider holds both slots, at most one of them divides
+    if (holdInExecute(idEx.instruction) || (idEx2.valid && holdInExecute(idEx2.instruction))) {
+        exMem.clear();
+        exMem2.clear();
+        return;
+    }
+    
+    markResultReady(idEx.instruction);
+    bool mispredicted = execute(idEx, exMem);
+    if (mispredicted || !idEx2.valid) {
+        // after a misprediction the younger slot is on the wrong path
+        exMem2.clear();
+    } else {
+        markResultReady(idEx2.instruction);
+        mispredicted = execute(idEx2, exMem2);
+    }
+    
+    // flush everything fetched after the branch, IF starts over at btpc
+    if (mispredicted) {
+        ifId.clear();
+        ifId2.clear();
+        idEx.clear();
+        idEx2.clear();
+        tibt = true;
+    }
+}
+
+bool DualIssueProcessor::execute(const PipelineRegister& in, PipelineRegister& out) {
+    const Instruction& instr = in.instruction;
+    out.instruction = instr;
+    out.pc = in.pc;
+    out.valid = true;
+    out.isBType = in.isBType;
+    
+    // register file, then both MEM/WB slots in program order
+    int rs1Value = registers.read(instr.getRs1());
+    int rs2Value = registers.read(instr.getRs2());
+    for (const PipelineRegister* wb : {&memWb, &memWb2}) {
+        if (wb->valid && wb->instruction.writesRd()) {
+            int rd = wb->instruction.getRd();
+            int wbValue = wb->instruction.isLoad() ? wb->readData : wb->aluResult;
+            if (instr.getRs1() == rd) {
+                rs1Value = wbValue;
+            }
+            if (instr.getRs2() == rd) {
+                rs2Value = wbValue;
+            }
+        }
+    }
+    out.rs1Value = rs1Value;
+    out.rs2Value = rs2Value;
+    out.aluResult = ALU::execute(instr.getAluOp(), rs1Value, rs2Value, instr.getImm(), in.pc);
+    
+    // branches and jumps resolve here, two fetch cycles are lost on a miss
+    if (!in.isBType) {
+        return false;
+    }
+    out.branchTaken = true;
+    if (instr.isBType()) {
+        out.branchTarget = in.pc + instr.getImm();
+        out.branchTaken = ALU::branchTaken(instr.getFunct3(), rs1Value, rs2Value);
+    } else if (instr.getOpcode() == 0x6F) {
+        // JAL
+        out.branchTarget = in.pc + instr.getImm();
+    } else {
+        // JALR
+        out.branchTarget = (rs1Value + instr.getImm()) & ~1;
+    }
+    if (!resolveBranch(in, out.branchTaken, out.branchTarget, 2)) {
+        return false;
+    }
+    btpc = out.branchTaken ? out.branchTarget : in.pc + 4;
+    return true;
+}
+
+void DualIssueProcessor::stageMEM() {
+    memoryStall = false;
+    
+    // pairing leaves at most one load or store per cycle, a data cache
+    // miss holds both slots
+    const PipelineRegister& access = (exMem2.valid && (exMem2.instruction.isLoad() || exMem2.instruction.isSType()))
+                                     ? exMem2 : exMem;
+    bool isAccess = access.valid && (access.instruction.isLoad() || access.instruction.isSType());
+    if (dcache.enabled() && isAccess && waitForData(access)) {
+        memWb.clear();
+        memWb2.clear();
+        memoryStall = true;
+        return;
+    }
+    
+    if (exMem.valid) {
+        accessMemory(exMem, memWb);
+    } else {
+        memWb.clear();
+    }
+    if (exMem2.valid) {
+        accessMemory(exMem2, memWb2);
+    } else {
+        memWb2.clear();
+    }
+}
+
+void DualIssueProcessor::stageWB() {
+    // older slot first so the younger one wins when both write a register
+    if (memWb.valid) {
+        writeBack(memWb);
+    }
+    if (memWb2.valid && haltReason == HaltReason::NONE) {
+        writeBack(memWb2);
+    }
+}
+
+bool DualIssueProcessor::pipelineEmpty() const {
+    return !ifId2.valid && !idEx2.valid && !exMem2.valid && !memWb2.valid && Processor::pipelineEmpty();
+}
+
+void DualIssueProcessor::updatePipelineTable() {
+    // same as Processor::updatePipelineTable for both slots, IF was drawn
+    // by endCycle and an instruction waiting in ID shows "-" again
+    if (memoryStall) {
+        return;
+    }
+    for (const PipelineRegister* wb : {&memWb, &memWb2}) {
+        if (wb->valid) {
+            updateInstructionStage(wb->pc, STAGE_WB);
+        }
+    }
+    for (const PipelineRegister* mem : {&exMem, &exMem2}) {
+        if (mem->valid) {
+            updateInstructionStage(mem->pc, STAGE_MEM);
+        }
+    }
+    if (executeStall) {
+        return;
+    }
+    for (const PipelineRegister* ex : {&idEx, &idEx2}) {
+        if (ex->valid) {
+            updateInstructionStage(ex->pc, STAGE_EX);
+        }
+    }
+    for (const PipelineRegister* id : {&ifId, &ifId2}) {
+        if (id->valid) {
+            updateInstructionStage(id->pc, STAGE_ID);
+        }
+    }
+}
+
+void DualIssueProcessor::saveVariantState(CheckpointWriter& out, bool) const {
+    out.put(ifId2);
+    out.put(idEx2);
+    out.put(exMem2);
+    out.put(memWb2);
+}
+
+void DualIssueProcessor::restoreVariantState(CheckpointReader& in) {
+    ifId2 = in.get<PipelineRegister>();
+    idEx2 = in.get<PipelineRegister>();
+    exMem2 = in.get<PipelineRegister>();
+    memWb2 = in.get<PipelineRegister>();
+}
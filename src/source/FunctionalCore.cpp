@@ -0,0 +1,221 @@
+#include "../include/FunctionalCore.hpp"
+#include <utility>
+using namespace std;
+
+namespace {
+
+using State = FunctionalCore::State;
+using MicroOp = FunctionalCore::MicroOp;
+using Handler = FunctionalCore::Handler;
+
+// Handlers, one instantiation per ALU op / funct3 so the operation is inlined
+
+template <AluOp OP>
+uint32_t aluHandler(State& state, const MicroOp& op) {
+    state.regs[op.rd] = ALU::apply<OP>(state.regs[op.rs1], state.regs[op.rs2], op.imm, op.pc);
+    return op.pc + 4;
+}
+
+template <int FUNCT3>
+uint32_t loadHandler(State& state, const MicroOp& op) {
+    state.regs[op.rd] = state.memory->load(FUNCT3, state.regs[op.rs1] + op.imm);
+    return op.pc + 4;
+}
+
+template <int FUNCT3>
+uint32_t storeHandler(State& state, const MicroOp& op) {
+    state.memory->store(FUNCT3, state.regs[op.rs1] + op.imm, state.regs[op.rs2]);
+    return op.pc + 4;
+}
+
+template <int FUNCT3>
+uint32_t branchHandler(State& state, const MicroOp& op) {
+    return ALU::condition<FUNCT3>(state.regs[op.rs1], state.regs[op.rs2]) ? op.pc + op.imm : op.pc + 4;
+}
+
+uint32_t jalHandler(State& state, const MicroOp& op) {
+    state.regs[op.rd] = op.pc + 4;
+    return op.pc + op.imm;
+}
+
+uint32_t jalrHandler(State& state, const MicroOp& op) {
+    // read rs1 before rd is written, they may be the same register
+    uint32_t target = (state.regs[op.rs1] + op.imm) & ~1u;
+    state.regs[op.rd] = op.pc + 4;
+    return target;
+}
+
+uint32_t nopHandler(State&, const MicroOp& op) {
+    return op.pc + 4;
+}
+
+template <size_t... OPS>
+constexpr array<Handler, sizeof...(OPS)> makeAluHandlers(index_sequence<OPS...>) {
+    return {{&aluHandler<static_cast<AluOp>(OPS)>...}};
+}
+
+
+const array<Handler, ALU::OP_COUNT> aluHandlers = makeAluHandlers(make_index_sequence<ALU::OP_COUNT>());
+const array<Handler, 8> loadHandlers = {{
+    &loadHandler<0>, &loadHandler<1>, &loadHandler<2>, &loadHandler<3>,
+    &loadHandler<4>, &loadHandler<5>, &loadHandler<6>, &loadHandler<7>
+}};
+const array<Handler, 8> storeHandlers = {{
+    &storeHandler<0>, &storeHandler<1>, &storeHandler<2>, &storeHandler<3>,
+    &storeHandler<4>, &storeHandler<5>, &storeHandler<6>, &storeHandler<7>
+}};
+const array<Handler, 8> branchHandlers = {{
+    &branchHandler<0>, &branchHandler<1>, &branchHandler<2>, &branchHandler<3>,
+    &branchHandler<4>, &branchHandler<5>, &branchHandler<6>, &branchHandler<7>
+}};
+
+} // namespace
+
+FunctionalCore::FunctionalCore(RegisterFile& registers, Memory& memory, uint32_t pc)
+    : registers(registers), memory(memory), pc(pc), instructionCount(0),
+      blockAt(memory.getInstructionCount(), -1) {
+}
+
+FunctionalCore::MicroOp FunctionalCore::translate(const Instruction& instr, uint32_t pc) {
+    MicroOp op;
+    op.pc = pc;
+    op.imm = instr.getImm();
+    op.rd = instr.writesRd() ? instr.getRd() : 32;
+    op.rs1 = instr.getRs1();
+    op.rs2 = instr.getRs2();
+    
+    switch (instr.getClass()) {
+        case InstrClass::LOAD:
+            // still performed for rd = x0, it may trap
+            op.rd = instr.getRd() != 0 ? instr.getRd() : 32;
+            op.handler = loadHandlers[instr.getFunct3()];
+            break;
+        case InstrClass::STORE:
+            op.handler = storeHandlers[instr.getFunct3()];
+            break;
+        case InstrClass::BRANCH:
+            op.handler = branchHandlers[instr.getFunct3()];
+            break;
+        case InstrClass::JAL:
+            op.handler = jalHandler;
+            break;
+        case InstrClass::JALR:
+            op.handler = jalrHandler;
+            break;
+        case InstrClass::NOP:
+            op.handler = nopHandler;
+            break;
+        default:
+            op.handler = aluHandlers[static_cast<size_t>(instr.getAluOp())];
+            break;
+    }
+    return op;
+}
+
+int FunctionalCore::findBlock(uint32_t pc) {
+    // only word aligned pcs inside the image are translated
+    if ((pc & 3) != 0 || !memory.isInstructionAddress(pc)) {
+        return -1;
+    }
+    size_t index = (pc - memory.getProgram().getTextBase()) / 4;
+    if (blockAt[index] >= 0) {
+        return blockAt[index];
+    }
+    
+    // translate up to and including the next branch or jalr, a jal has a
+    // fixed target so translation just continues there
+    Block block;
+    uint32_t last = pc;
+    uint32_t at = pc;
+    while (block.ops.size() < MAX_BLOCK_LENGTH) {
+        const Instruction& instr = *memory.getInstruction(at);
+        block.ops.push_back(translate(instr, at));
+        last = at;
+        InstrClass kind = instr.getClass();
+        if (kind == InstrClass::BRANCH || kind == InstrClass::JALR) {
+            break;
+        }
+        at = kind == InstrClass::JAL ? at + instr.getImm() : at + 4;
+        if ((at & 3) != 0 || !memory.isInstructionAddress(at)) {
+            break;
+        }
+    }
+    
+    // fall-through first, then the branch/jal target (jalr fills it in when first taken)
+    const Instruction& end = *memory.getInstruction(last);
+    block.successorPc[0] = end.getClass() == InstrClass::JAL ? last + end.getImm() : last + 4;
+    block.successorPc[1] = end.getClass() == InstrClass::BRANCH ? last + end.getImm() : 0;
+    block.successor[0] = -1;
+    block.successor[1] = -1;
+    
+    blocks.push_back(move(block));
+    blockAt[index] = blocks.size() - 1;
+    return blockAt[index];
+}
+
+uint32_t FunctionalCore::stepMany(State& state, uint32_t pc, uint64_t count) const {
+    for (uint64_t i = 0; i < count; i++) {
+        MicroOp op = translate(*memory.getInstruction(pc), pc);
+        pc = op.handler(state, op);
+    }
+    return pc;
+}
+
+void FunctionalCore::step() {
+    run(1);
+}
+
+void FunctionalCore::run(uint64_t count) {
+    State state;
+    for (int i = 0; i < 32; i++) {
+        state.regs[i] = registers.read(i);
+    }
+    state.regs[32] = 0;
+    state.memory = &memory;
+    
+    uint32_t current = pc;
+    uint64_t remaining = count;
+    int block = findBlock(current);
+    while (remaining > 0) {
+        if (block < 0 || blocks[block].ops.size() > remaining) {
+            // outside the image, a misaligned pc, or the budget ends inside this block
+            uint64_t n = block < 0 ? 1 : remaining;
+            if (!memory.isInstructionAddress(current)) {
+                // only NOPs out here, skip straight to where pc wraps back into the image
+                uint64_t distance = static_cast<uint32_t>(memory.getProgram().getTextBase() - current);
+                n = min(remaining, max<uint64_t>(1, (distance + 3) / 4));
+                current += static_cast<uint32_t>(n * 4);
+            } else {
+                current = stepMany(state, current, n);
+            }
+            remaining -= n;
+            block = remaining > 0 ? findBlock(current) : -1;
+            continue;
+        }
+        
+        for (const MicroOp& op : blocks[block].ops) {
+            current = op.handler(state, op);
+        }
+        remaining -= blocks[block].ops.size();
+        
+        // follow the chain, link the successor on first use
+        Block& done = blocks[block];
+        if (current == done.successorPc[0] && done.successor[0] >= 0) {
+            block = done.successor[0];
+        } else if (current == done.successorPc[1] && done.successor[1] >= 0) {
+            block = done.successor[1];
+        } else {
+            int from = block;
+            int slot = current == done.successorPc[0] ? 0 : 1;
+            block = findBlock(current);        // may grow blocks, done is stale now
+            blocks[from].successorPc[slot] = current;
+            blocks[from].successor[slot] = block;
+        }
+    }
+    
+    for (int i = 1; i < 32; i++) {
+        registers.write(i, state.regs[i]);
+    }
+    pc = current;
+    instructionCount += count;
+}
@@ -1,11 +1,8 @@
 #include "../include/Instruction.hpp"
+#include <cstdio>
 using namespace std;
 
-Instruction::Instruction() : machineCode(0), assembly("NOP") {
-    decode();
-}
-
-Instruction::Instruction(uint32_t code, const string& asm_str) : machineCode(code), assembly(asm_str) {
+Instruction::Instruction(uint32_t code) : machineCode(code) {
     decode();
 }
 
@@ -56,7 +53,35 @@ void Instruction::decode() {
         if (imm & 0x100000) {
             imm |= 0xFFE00000;
         }
+    } else if (opcode == 0x73) {
+        // SYSTEM: the CSR number, unsigned
+        imm = machineCode >> 20;
+    } else {
+        imm = 0; // NOP / unsupported opcodes
+    }
+    
+    // resolve the opcode class once so later stages don't re-test the opcode
+    switch (opcode) {
+        case 0x33: instrClass = InstrClass::ALU; break;
+        case 0x13: instrClass = InstrClass::ALU_IMM; break;
+        case 0x03: instrClass = InstrClass::LOAD; break;
+        case 0x23: instrClass = InstrClass::STORE; break;
+        case 0x63: instrClass = InstrClass::BRANCH; break;
+        case 0x6F: instrClass = InstrClass::JAL; break;
+        case 0x67: instrClass = InstrClass::JALR; break;
+        case 0x37: instrClass = InstrClass::LUI; break;
+        case 0x17: instrClass = InstrClass::AUIPC; break;
+        case 0x73: instrClass = InstrClass::SYSTEM; break;
+        default:   instrClass = InstrClass::NOP; break;
     }
+    
+    // everything except stores, branches and NOPs writes rd in WB
+    bool hasResult = !(instrClass == InstrClass::STORE || instrClass == InstrClass::BRANCH ||
+                       instrClass == InstrClass::NOP);
+    writesRdFlag = hasResult && rd != 0;
+    
+    // and the ALU operation, so EX doesn't look at funct3/funct7 again
+    aluOp = ALU::resolve(opcode, funct3, funct7, imm);
 }
 
 bool Instruction::isRType() const {
@@ -105,3 +130,67 @@ bool Instruction::isJump() const {
 bool Instruction::isALU() const {
     return (isRType() || opcode == 0x13);  // R-type or immediate ALU ops
 }
+
+string Instruction::disassemble() const {
+    static const char* aluOps[8] = {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"};
+    static const char* mulOps[8] = {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"};
+    static const char* immOps[8] = {"addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi"};
+    static const char* loadOps[8] = {"lb", "lh", "lw", "?", "lbu", "lhu", "?", "?"};
+    static const char* storeOps[8] = {"sb", "sh", "sw", "?", "?", "?", "?", "?"};
+    static const char* branchOps[8] = {"beq", "bne", "?", "?", "blt", "bge", "bltu", "bgeu"};
+    
+    auto x = [](int reg) { return "x" + to_string(reg); };
+    switch (instrClass) {
+        case InstrClass::ALU: {
+            string name = (funct7 == 0x01) ? mulOps[funct3] : aluOps[funct3];
+            if (funct7 == 0x20) {
+                name = (funct3 == 0x0) ? "sub" : "sra";
+            }
+            return name + " " + x(rd) + ", " + x(rs1) + ", " + x(rs2);
+        }
+        case InstrClass::ALU_IMM: {
+            string name = immOps[funct3];
+            int value = imm;
+            if (funct3 == 0x1 || funct3 == 0x5) {
+                // shifts only use the low 5 bits, bit 10 selects srai
+                if (funct3 == 0x5 && (imm & 0x400)) {
+                    name = "srai";
+                }
+                value = imm & 0x1F;
+            }
+            return name + " " + x(rd) + ", " + x(rs1) + ", " + to_string(value);
+        }
+        case InstrClass::LOAD:
+            return string(loadOps[funct3]) + " " + x(rd) + ", " + to_string(imm) + "(" + x(rs1) + ")";
+        case InstrClass::STORE:
+            return string(storeOps[funct3]) + " " + x(rs2) + ", " + to_string(imm) + "(" + x(rs1) + ")";
+        case InstrClass::BRANCH:
+            return string(branchOps[funct3]) + " " + x(rs1) + ", " + x(rs2) + ", " + to_string(imm);
+        case InstrClass::JAL:
+            return "jal " + x(rd) + ", " + to_string(imm);
+        case InstrClass::JALR:
+            return "jalr " + x(rd) + ", " + x(rs1) + ", " + to_string(imm);
+        case InstrClass::LUI:
+        case InstrClass::AUIPC: {
+            char upper[16];
+            snprintf(upper, sizeof(upper), "0x%x", static_cast<uint32_t>(imm) >> 12);
+            return string(instrClass == InstrClass::LUI ? "lui " : "auipc ") + x(rd) + ", " + upper;
+        }
+        case InstrClass::SYSTEM:
+            if (aluOp == AluOp::HARTID) {
+                return "csrr " + x(rd) + ", mhartid";
+            }
+            break;
+        default:
+            break;
+    }
+    if (machineCode == 0x00000073) {
+        return "ecall";
+    }
+    if (machineCode == 0x00100073) {
+        return "ebreak";
+    }
+    char raw[24];
+    snprintf(raw, sizeof(raw), ".word 0x%08x", machineCode);
+    return raw;
+}
@@ -1,111 +1,235 @@
 #include "../include/Memory.hpp"
+#include <cstring>
 using namespace std;
 
-Memory::Memory(size_t size) : data(size, 0) {
+// the aligned fast paths copy whole words straight out of the page
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Memory assumes a little-endian host"
+#endif
+
+Memory::Memory() : misalignedAccesses(0), trapMisaligned(false),
+                   program(make_shared<ProgramImage>()), shared(nullptr) {
+}
+
+const uint8_t* Memory::findPage(uint32_t address) const {
+    const PageTable* table = directory[address >> (PAGE_BITS + TABLE_BITS)].get();
+    const Page* page = table ? table->pages[(address >> PAGE_BITS) & (TABLE_SIZE - 1)].get() : nullptr;
+    if (page != nullptr) {
+        return page->data();
+    }
+    // a hart reads what it hasn't stored to from the shared memory
+    return shared ? shared->findPage(address) : nullptr;
+}
+
+uint8_t* Memory::touchPage(uint32_t address) {
+    unique_ptr<PageTable>& table = directory[address >> (PAGE_BITS + TABLE_BITS)];
+    if (!table) {
+        table = make_unique<PageTable>();
+    }
+    unique_ptr<Page>& page = table->pages[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+    if (!page) {
+        // a hart's first store to a page starts from the shared contents
+        const uint8_t* from = shared ? shared->findPage(address) : nullptr;
+        page = make_unique<Page>();
+        if (from != nullptr) {
+            memcpy(page->data(), from, PAGE_SIZE);
+        } else {
+            page->fill(0);
+        }
+        touchedPages.push_back(address >> PAGE_BITS);
+    }
+    return page->data();
 }
 
 uint8_t Memory::readByte(uint32_t address) const {
-    if (address >= data.size()) {
-        throw out_of_range("Memory address out of bounds");
+    const uint8_t* page = findPage(address);
+    if (page == nullptr) {
+        return 0; // untouched memory reads as zero
+    }
+    return page[address & (PAGE_SIZE - 1)];
+}
+
+void Memory::misaligned(uint32_t address, const char* access) const {
+    misalignedAccesses++;
+    if (trapMisaligned) {
+        ostringstream msg;
+        msg << "Misaligned " << access << " at address 0x" << hex << address;
+        throw runtime_error(msg.str());
     }
-    return data[address];
 }
 
 uint16_t Memory::readHalf(uint32_t address) const {
-    if (address + 1 >= data.size()) {
-        throw out_of_range("Memory address out of bounds");
+    // aligned halves never cross a page: one lookup, one load
+    if ((address & 1) == 0) {
+        const uint8_t* page = findPage(address);
+        if (page == nullptr) {
+            return 0;
+        }
+        uint16_t value;
+        memcpy(&value, page + (address & (PAGE_SIZE - 1)), sizeof(value));
+        return value;
     }
-    return static_cast<uint16_t>(data[address]) |
-           (static_cast<uint16_t>(data[address + 1]) << 8);
+    
+    misaligned(address, "half read");
+    return static_cast<uint16_t>(readByte(address)) |
+           (static_cast<uint16_t>(readByte(address + 1)) << 8);
 }
 
 uint32_t Memory::readWord(uint32_t address) const {
-    if (address + 3 >= data.size()) {
-        throw out_of_range("Memory address out of bounds");
+    // aligned words never cross a page: one lookup, one load
+    if ((address & 3) == 0) {
+        const uint8_t* page = findPage(address);
+        if (page == nullptr) {
+            return 0;
+        }
+        uint32_t value;
+        memcpy(&value, page + (address & (PAGE_SIZE - 1)), sizeof(value));
+        return value;
     }
-    return static_cast<uint32_t>(data[address]) |
-           (static_cast<uint32_t>(data[address + 1]) << 8) |
-           (static_cast<uint32_t>(data[address + 2]) << 16) |
-           (static_cast<uint32_t>(data[address + 3]) << 24);
+    
+    misaligned(address, "word read");
+    return static_cast<uint32_t>(readByte(address)) |
+           (static_cast<uint32_t>(readByte(address + 1)) << 8) |
+           (static_cast<uint32_t>(readByte(address + 2)) << 16) |
+           (static_cast<uint32_t>(readByte(address + 3)) << 24);
 }
 
 void Memory::writeByte(uint32_t address, uint8_t value) {
-    if (address >= data.size()) {
-        throw out_of_range("Memory address out of bounds");
-    }
-    data[address] = value;
+    touchPage(address)[address & (PAGE_SIZE - 1)] = value;
 }
 
 void Memory::writeHalf(uint32_t address, uint16_t value) {
-    if (address + 1 >= data.size()) {
-        throw out_of_range("Memory address out of bounds");
+    if ((address & 1) == 0) {
+        memcpy(touchPage(address) + (address & (PAGE_SIZE - 1)), &value, sizeof(value));
+        return;
     }
-    data[address] = value & 0xFF;
-    data[address + 1] = (value >> 8) & 0xFF;
+    
+    misaligned(address, "half write");
+    writeByte(address, value & 0xFF);
+    writeByte(address + 1, (value >> 8) & 0xFF);
 }
 
 void Memory::writeWord(uint32_t address, uint32_t value) {
-    if (address + 3 >= data.size()) {
-        throw out_of_range("Memory address out of bounds");
+    if ((address & 3) == 0) {
+        memcpy(touchPage(address) + (address & (PAGE_SIZE - 1)), &value, sizeof(value));
+        return;
     }
-    data[address] = value & 0xFF;
-    data[address + 1] = (value >> 8) & 0xFF;
-    data[address + 2] = (value >> 16) & 0xFF;
-    data[address + 3] = (value >> 24) & 0xFF;
+    
+    misaligned(address, "word write");
+    writeByte(address, value & 0xFF);
+    writeByte(address + 1, (value >> 8) & 0xFF);
+    writeByte(address + 2, (value >> 16) & 0xFF);
+    writeByte(address + 3, (value >> 24) & 0xFF);
 }
 
-void Memory::loadInstructions(const string& filename) {
-    instructions.clear();
-    
-    ifstream file(filename);
-    if (!file.is_open()) {
-        throw runtime_error("Could not open instruction file: " + filename);
+uint32_t Memory::load(int funct3, uint32_t address) const {
+    switch (funct3) {
+        case 0x0: // LB - Load Byte
+            return static_cast<int8_t>(readByte(address));
+        case 0x1: // LH - Load Half
+            return static_cast<int16_t>(readHalf(address));
+        case 0x2: // LW - Load Word
+            return readWord(address);
+        case 0x4: // LBU - Load Byte Unsigned
+            return readByte(address);
+        case 0x5: // LHU - Load Half Unsigned
+            return readHalf(address);
+        default:
+            return 0;
     }
-    
-    string line;
-    while (getline(file, line)) {
-        // Skip empty lines and comments
-        if (line.empty() || line[0] == '#') {
-            continue;
-        }
-        
-        istringstream iss(line);
-        string machineCodeStr;
-        string assembly;
-        
-        // Read the first token as machine code
-        iss >> machineCodeStr;
-        
-        // Convert machine code string to uint32_t as hexadecimal
-        uint32_t machineCode;
-        stringstream ss;
-        ss << hex << machineCodeStr;
-        ss >> machineCode;
-        
-        // Get rest of line as assembly code
-        getline(iss >> ws, assembly);
-        
-        // Remove leading/trailing whitespace from assembly
-        assembly.erase(0, assembly.find_first_not_of(" \t\r\n"));
-        assembly.erase(assembly.find_last_not_of(" \t\r\n") + 1);
-        
-        instructions.emplace_back(machineCode, assembly);
+}
+
+void Memory::store(int funct3, uint32_t address, uint32_t value) {
+    switch (funct3) {
+        case 0x0: // SB - Store Byte
+            writeByte(address, value & 0xFF);
+            break;
+        case 0x1: // SH - Store Half
+            writeHalf(address, value & 0xFFFF);
+            break;
+        case 0x2: // SW - Store Word
+            writeWord(address, value);
+            break;
+        default:
+            return;
     }
-    
-    if (instructions.empty()) {
-        throw runtime_error("No valid instructions found in file: " + filename);
+    if (shared) {
+        storeBuffer.push_back({address, value, funct3});
+    }
+}
+
+void Memory::writeBlock(uint32_t address, string_view bytes) {
+    // page by page instead of byte by byte
+    size_t done = 0;
+    while (done < bytes.size()) {
+        uint32_t at = address + static_cast<uint32_t>(done);
+        uint32_t offset = at & (PAGE_SIZE - 1);
+        size_t chunk = min<size_t>(PAGE_SIZE - offset, bytes.size() - done);
+        memcpy(touchPage(at) + offset, bytes.data() + done, chunk);
+        done += chunk;
+    }
+}
+
+void Memory::loadInstructions(const string& filename) {
+    setProgram(ProgramImage::load(filename));
+}
+
+void Memory::setProgram(shared_ptr<const ProgramImage> image) {
+    program = move(image);
+    // initialized data lands at its linked address, the rest reads as zero
+    for (const ProgramImage::Segment& segment : program->getSegments()) {
+        writeBlock(segment.address, segment.bytes);
     }
 }
 
-Instruction Memory::getInstruction(uint32_t pc) const {
-    size_t index = pc / 4;
-    if (index >= instructions.size()) {
-        return Instruction(); // Return NOP if beyond instruction memory
+void Memory::releasePages() {
+    // drop only what was touched, page tables go with their pages
+    for (uint32_t pageNumber : touchedPages) {
+        directory[pageNumber >> TABLE_BITS].reset();
     }
-    return instructions[index];
+    touchedPages.clear();
 }
 
 void Memory::reset() {
-    fill(data.begin(), data.end(), 0);
-    instructions.clear();
+    releasePages();
+    misalignedAccesses = 0;
+    program = make_shared<ProgramImage>();
+    shared = nullptr;
+    storeBuffer.clear();
+}
+
+void Memory::attach(Memory& sharedMemory) {
+    releasePages();
+    storeBuffer.clear();
+    shared = &sharedMemory;
+}
+
+void Memory::commitStores() {
+    // replaying the stores gives shared exactly the bytes this hart wrote,
+    // the copies of the pages also hold stale bytes of other harts
+    for (const BufferedStore& buffered : storeBuffer) {
+        shared->store(buffered.funct3, buffered.address, buffered.value);
+    }
+    storeBuffer.clear();
+    releasePages();
+}
+
+void Memory::saveState(CheckpointWriter& out) const {
+    out.put(misalignedAccesses);
+    out.put(static_cast<uint32_t>(touchedPages.size()));
+    for (uint32_t pageNumber : touchedPages) {
+        out.put(pageNumber);
+        out.putBytes(findPage(pageNumber << PAGE_BITS), PAGE_SIZE);
+    }
+}
+
+void Memory::restoreState(CheckpointReader& in) {
+    // every page the program load touched was checkpointed too, so writing
+    // the saved pages over the loaded ones gives back the exact contents
+    misalignedAccesses = in.get<uint64_t>();
+    uint32_t pageCount = in.get<uint32_t>();
+    for (uint32_t i = 0; i < pageCount; i++) {
+        uint32_t pageNumber = in.get<uint32_t>();
+        writeBlock(pageNumber << PAGE_BITS, in.getView(PAGE_SIZE));
+    }
 }
@@ -0,0 +1,94 @@
+#include "../include/MultiHartRunner.hpp"
+#include "../include/WorkStealingPool.hpp"
+#include <thread>
+using namespace std;
+
+MultiHartRunner::MultiHartRunner(int quantum, size_t threadCount)
+    : quantum(quantum), threadCount(threadCount), quanta(0), committedStores(0) {
+}
+
+void MultiHartRunner::addHart(unique_ptr<Processor> hart) {
+    hart->setHartId(static_cast<uint32_t>(harts.size()));
+    // harts run at the same time, each writes its diagram to its own buffer
+    diagrams.push_back(make_unique<ostringstream>());
+    hart->setOutput(*diagrams.back());
+    harts.push_back(move(hart));
+}
+
+void MultiHartRunner::loadProgram(const string& filename) {
+    // one decoded image for all, the data segments go to the shared memory
+    shared_ptr<const ProgramImage> image = ProgramImage::load(filename);
+    shared.setProgram(image);
+    for (auto& hart : harts) {
+        hart->loadProgram(image);
+        hart->shareMemory(shared);
+    }
+}
+
+void MultiHartRunner::run(int cycles, ostream& out) {
+    size_t threads = threadCount;
+    if (threads == 0) {
+        threads = min<size_t>(harts.size(), max(1u, thread::hardware_concurrency()));
+    }
+    WorkStealingPool pool(threads);
+    vector<string> errors(harts.size());
+    for (int done = 0; done < cycles; done += quantum) {
+        int slice = min(quantum, cycles - done);
+        for (size_t i = 0; i < harts.size(); i++) {
+            pool.submit([this, &errors, i, slice] {
+                try {
+                    harts[i]->simulate(slice);
+                } catch (const exception& e) {
+                    errors[i] = e.what();
+                }
+            });
+        }
+        pool.wait();
+        for (size_t i = 0; i < harts.size(); i++) {
+            if (!errors[i].empty()) {
+                throw runtime_error("hart " + to_string(i) + ": " + errors[i]);
+            }
+        }
+        
+        // barrier: publish the quantum's stores, lower harts first
+        for (auto& hart : harts) {
+            committedStores += hart->getBufferedStores();
+            hart->commitStores();
+        }
+        quanta++;
+        
+        // --halt: done once every hart stopped
+        if (all_of(harts.begin(), harts.end(), [](const unique_ptr<Processor>& hart) { return hart->isHalted(); })) {
+            break;
+        }
+    }
+    
+    for (size_t i = 0; i < harts.size(); i++) {
+        harts[i]->run(0);
+        const string text = diagrams[i]->str();
+        if (!text.empty()) {
+            out << (i > 0 ? "\n" : "") << "Hart " << i << ":\n" << text;
+        }
+    }
+    out.flush();
+}
+
+void MultiHartRunner::writeCountersJson(ostream& out) const {
+    out << "{\"quantum\": " << quantum << ", \"harts\": [";
+    for (size_t i = 0; i < harts.size(); i++) {
+        out << (i > 0 ? ", " : "");
+        harts[i]->writeCountersJson(out);
+    }
+    out << "]}";
+}
+
+void MultiHartRunner::printStats(ostream& out) const {
+    out << "Quanta: " << quanta << " of " << quantum << " cycles, "
+        << committedStores << " stores committed to shared memory\n";
+    for (size_t i = 0; i < harts.size(); i++) {
+        out << "Hart " << i << ": misaligned accesses: " << harts[i]->getMisalignedAccesses() << "\n";
+        harts[i]->printBranchStats(out);
+        harts[i]->printCacheStats(out);
+        harts[i]->printVariantStats(out);
+    }
+}
@@ -1,6 +1,7 @@
 #include "../include/NonForwardingProcessor.hpp"
 using namespace std;
-NonForwardingProcessor::NonForwardingProcessor() : Processor() {
+NonForwardingProcessor::NonForwardingProcessor() {
+    variantName = "noforward";
 }
 
 void NonForwardingProcessor::detectHazards() {
@@ -11,44 +12,33 @@ void NonForwardingProcessor::detectHazards() {
         return;
     }
     
-    auto idInstr = ifId.instruction;
+    const Instruction& idInstr = ifId.instruction;
     
-    // Check for read-after-write hazards with instructions in EX stage
-    if (idEx.valid && idEx.instruction->getRd() != 0) {
-        int exDest = idEx.instruction->getRd();
-        
-        // check if either source register of ID depends on EX destination
-        if (idInstr->getRs1() == exDest || 
-            (idInstr->getRs2() == exDest && !idInstr->isIType() && !idInstr->isUType() && !idInstr->isJType())) {
-            // RAW hazard detected, stall the pipeline
-            stall = true;
-            return;
+    // Check for read-after-write hazards with every instruction between ID
+    // and WB, youngest first: EX (and its sub-stages), MEM2.., then the one
+    // entering WB. ID reads the register file after WB in the same cycle.
+    for (int position = 0; position < backEndSize(); position++) {
+        const PipelineRegister& older = backEnd(position);
+        if (!older.valid || older.instruction.getRd() == 0) {
+            continue;
         }
-    }
-    
-    // Check for RAW hazards with instructions in MEM stage
-    if (exMem.valid && exMem.instruction->getRd() != 0) {
-        int memDest = exMem.instruction->getRd();
+        int dest = older.instruction.getRd();
         
-        // check if either source register of ID depends on MEM destination
-        if (idInstr->getRs1() == memDest || 
-            (idInstr->getRs2() == memDest && !idInstr->isIType() && !idInstr->isUType() && !idInstr->isJType())) {
+        // check if either source register of ID depends on the destination
+        if (idInstr.getRs1() == dest || 
+            (idInstr.getRs2() == dest && !idInstr.isIType() && !idInstr.isUType() && !idInstr.isJType())) {
             // RAW hazard detected, stall the pipeline
             stall = true;
+            StallCause cause = position < depth.execute ? STALL_RAW_EX
+                             : position < backEndSize() - 1 ? STALL_RAW_MEM : STALL_RAW_WB;
+            counters.stalls[cause]++;
             return;
         }
     }
     
-    // check for RAW hazards with instructions in WB stage
-    if (memWb.valid && memWb.instruction->getRd() != 0) {
-        int wbDest = memWb.instruction->getRd();
-        
-        // Check if either source register of ID depends on WB destination
-        if (idInstr->getRs1() == wbDest || 
-            (idInstr->getRs2() == wbDest && !idInstr->isIType() && !idInstr->isUType() && !idInstr->isJType())) {
-            // RAW hazard detected, stall the pipeline
-            stall = true;
-            return;
-        }
+    // source still in the multiplier
+    if (waitsForMultiplier(idInstr)) {
+        stall = true;
+        counters.stalls[STALL_MULTIPLY]++;
     }
 }
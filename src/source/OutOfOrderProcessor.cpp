@@ -0,0 +1,526 @@
+#include "../include/OutOfOrderProcessor.hpp"
+using namespace std;
+
+// bytes accessed by a load/store funct3, 0 for unknown widths
+static uint32_t accessSize(int funct3) {
+    switch (funct3 & 0x3) {
+        case 0x0: return 1;
+        case 0x1: return 2;
+        case 0x2: return 4;
+        default:  return 0;
+    }
+}
+
+OutOfOrderProcessor::OutOfOrderProcessor() : robHead(0), robCount(0), issueCount(0), loadStoreCount(0),
+                                             dividerFreeCycle(0), nextSeq(0), timelineFirst(0) {
+    variantName = "outoforder";
+    rob.resize(sizes.reorderBuffer);
+    producer.fill(-1);
+}
+
+void OutOfOrderProcessor::setQueueSizes(const QueueSizes& newSizes) {
+    if (cycleCount > 0 || robCount > 0) {
+        throw runtime_error("Queue sizes must be set before the core runs");
+    }
+    if (newSizes.reorderBuffer <= 0 || newSizes.issueQueue <= 0 || newSizes.loadStoreQueue <= 0) {
+        throw runtime_error("Queue sizes must be positive");
+    }
+    sizes = newSizes;
+    rob.assign(sizes.reorderBuffer, RobEntry());
+    robHead = 0;
+}
+
+void OutOfOrderProcessor::run(int cycles) {
+    simulate(cycles);
+    finishRun();
+}
+
+void OutOfOrderProcessor::simulate(int cycles) {
+    for (int i = 0; i < cycles && haltReason == HaltReason::NONE; ++i) {
+        commit();
+        if (haltReason != HaltReason::NONE) {
+            // --halt: an ecall/ebreak committed, the rest is never committed
+            cycleCount++;
+            break;
+        }
+        complete();
+        issue();
+        dispatch();
+        stageIF();
+        endCycle();
+    }
+}
+
+OutOfOrderProcessor::Unit OutOfOrderProcessor::unitOf(const Instruction& instr) {
+    if (instr.isLoad() || instr.isSType()) {
+        return UNIT_MEMORY;
+    }
+    if (ALU::isMultiply(instr.getAluOp()) || ALU::isDivide(instr.getAluOp())) {
+        return UNIT_MULDIV;
+    }
+    return UNIT_ALU;
+}
+
+void OutOfOrderProcessor::commit() {
+    if (robCount == 0 || !rob[robHead].done) {
+        return;
+    }
+    RobEntry& head = rob[robHead];
+    const Instruction& instr = head.op.instruction;
+    if (instr.isSType()) {
+        // stores write memory now, a data cache miss holds commit
+        if (dcache.enabled() && waitForData(head.op)) {
+            return;
+        }
+        memory.store(instr.getFunct3(), head.op.aluResult, head.op.rs2Value);
+        counters.stores++;
+        loadStoreCount--;
+    } else if (instr.isLoad()) {
+        counters.loads++;
+        loadStoreCount--;
+    }
+    
+    writeBack(head.op);
+    if (instr.writesRd() && producer[instr.getRd()] == robHead) {
+        producer[instr.getRd()] = -1;
+    }
+    if (diagramEnabled) {
+        row(head.seq).commit = cycleCount;
+    }
+    robHead = (robHead + 1) % sizes.reorderBuffer;
+    robCount--;
+}
+
+void OutOfOrderProcessor::complete() {
+    for (int i = 0; i < robCount; i++) {
+        int slot = slotAt(i);
+        RobEntry& entry = rob[slot];
+        if (!entry.issued || entry.done || entry.completeCycle > cycleCount) {
+            continue;
+        }
+        entry.done = true;
+        if (diagramEnabled) {
+            row(entry.seq).complete = cycleCount;
+        }
+        broadcast(slot);
+    
+        // a wrong prediction flushes everything younger and redirects IF
+        const PipelineRegister& op = entry.op;
+        int wrongPath = robCount - i - 1 + ifId.valid;
+        if (op.isBType && resolveBranch(op, op.branchTaken, op.branchTarget, wrongPath)) {
+            flushAfter(i);
+            ifId.clear();
+            btpc = op.branchTaken ? op.branchTarget : op.pc + 4;
+            tibt = true;
+            return;
+        }
+    }
+}
+
+void OutOfOrderProcessor::broadcast(int slot) {
+    uint32_t value = resultOf(rob[slot]);
+    for (int i = 0; i < robCount; i++) {
+        RobEntry& waiting = rob[slotAt(i)];
+        if (waiting.issued) {
+            continue;
+        }
+        if (waiting.waitsOn[0] == slot) {
+            waiting.op.rs1Value = value;
+            waiting.waitsOn[0] = -1;
+        }
+        if (waiting.waitsOn[1] == slot) {
+            waiting.op.rs2Value = value;
+            waiting.waitsOn[1] = -1;
+        }
+    }
+}
+
+void OutOfOrderProcessor::flushAfter(int index) {
+    for (int i = robCount - 1; i > index; i--) {
+        const RobEntry& entry = rob[slotAt(i)];
+        if (entry.unit == UNIT_MEMORY) {
+            loadStoreCount--;
+        } else if (!entry.issued) {
+            issueCount--;
+        }
+        if (diagramEnabled) {
+            row(entry.seq).flushed = true;
+        }
+    }
+    robCount = index + 1;
+    
+    // the remaining entries are the newest writers of their registers
+    producer.fill(-1);
+    for (int i = 0; i < robCount; i++) {
+        const Instruction& instr = rob[slotAt(i)].op.instruction;
+        if (instr.writesRd()) {
+            producer[instr.getRd()] = slotAt(i);
+        }
+    }
+}
+
+void OutOfOrderProcessor::issue() {
+    // the oldest ready instruction of every unit starts
+    bool unitBusy[UNIT_COUNT] = {};
+    for (int i = 0; i < robCount; i++) {
+        RobEntry& entry = rob[slotAt(i)];
+        if (entry.issued || unitBusy[entry.unit] || entry.waitsOn[0] >= 0 || entry.waitsOn[1] >= 0) {
+            continue;
+        }
+        int latency = execute(i, entry);
+        if (latency < 0) {
+            continue;
+        }
+        entry.issued = true;
+        entry.completeCycle = cycleCount + latency;
+        unitBusy[entry.unit] = true;
+        if (entry.unit != UNIT_MEMORY) {
+            issueCount--;
+        }
+        if (diagramEnabled) {
+            row(entry.seq).issue = cycleCount;
+        }
+    }
+}
+
+int OutOfOrderProcessor::execute(int index, RobEntry& entry) {
+    PipelineRegister& op = entry.op;
+    const Instruction& instr = op.instruction;
+    
+    if (entry.unit == UNIT_MEMORY) {
+        // loads/stores compute their address, stores are then done until commit
+        op.aluResult = ALU::execute(instr.getAluOp(), op.rs1Value, op.rs2Value, instr.getImm(), op.pc);
+        if (instr.isSType()) {
+            return 1;
+        }
+        // with --trap-misaligned a misaligned load only runs once it is not speculative
+        uint32_t size = accessSize(instr.getFunct3());
+        if (memory.trapsMisaligned() && size > 1 && op.aluResult % size != 0 && index > 0) {
+            return -1;
+        }
+        uint32_t value;
+        if (!loadValue(index, entry, value)) {
+            return -1;
+        }
+        op.readData = value;
+        uint32_t missLatency = dcache.enabled() ? dcache.access(op.aluResult, false) : 0;
+        counters.stalls[STALL_DCACHE] += missLatency;
+        return 1 + missLatency;
+    }
+    
+    int latency = 1;
+    if (entry.unit == UNIT_MULDIV) {
+        // the multiplier is pipelined, the divider takes one instruction at a time
+        if (ALU::isDivide(instr.getAluOp())) {
+            if (dividerFreeCycle > cycleCount) {
+                return -1;
+            }
+            dividerFreeCycle = cycleCount + divLatency;
+            latency = divLatency;
+        } else {
+            latency = mulLatency;
+        }
+    }
+    op.aluResult = ALU::execute(instr.getAluOp(), op.rs1Value, op.rs2Value, instr.getImm(), op.pc);
+    
+    // branches and jumps resolve when they complete
+    if (instr.isBType()) {
+        op.branchTarget = op.pc + instr.getImm();
+        op.branchTaken = ALU::branchTaken(instr.getFunct3(), op.rs1Value, op.rs2Value);
+    } else if (instr.getOpcode() == 0x6F) {
+        // JAL
+        op.branchTarget = op.pc + instr.getImm();
+        op.branchTaken = true;
+    } else if (instr.getOpcode() == 0x67) {
+        // JALR
+        op.branchTarget = (op.rs1Value + instr.getImm()) & ~1;
+        op.branchTaken = true;
+    }
+    return latency;
+}
+
+bool OutOfOrderProcessor::loadValue(int index, const RobEntry& entry, uint32_t& value) const {
+    const Instruction& load = entry.op.instruction;
+    uint32_t address = entry.op.aluResult;
+    uint32_t size = accessSize(load.getFunct3());
+    
+    // older stores, youngest first
+    for (int i = index - 1; i >= 0; i--) {
+        const RobEntry& older = rob[slotAt(i)];
+        if (!older.op.instruction.isSType()) {
+            continue;
+        }
+        if (!older.issued) {
+            return false;
+        }
+        uint64_t storeStart = static_cast<uint32_t>(older.op.aluResult);
+        uint64_t storeEnd = storeStart + accessSize(older.op.instruction.getFunct3());
+        if (address + uint64_t(size) <= storeStart || address >= storeEnd) {
+            continue;
+        }
+        if (address < storeStart || address + uint64_t(size) > storeEnd) {
+            return false;
+        }
+    
+        // forward the covered bytes, extended like Memory::load
+        uint32_t raw = static_cast<uint32_t>(older.op.rs2Value) >> (8 * (address - storeStart));
+        switch (load.getFunct3()) {
+            case 0x0: value = static_cast<int8_t>(raw); break;
+            case 0x1: value = static_cast<int16_t>(raw); break;
+            case 0x4: value = raw & 0xFF; break;
+            case 0x5: value = raw & 0xFFFF; break;
+            default:  value = raw; break;
+        }
+        return true;
+    }
+    value = memory.load(load.getFunct3(), address);
+    return true;
+}
+
+void OutOfOrderProcessor::readOperand(RobEntry& entry, int operand, int reg) {
+    int value = 0;
+    entry.waitsOn[operand] = -1;
+    if (reg != 0) {
+        int slot = producer[reg];
+        if (slot < 0) {
+            value = registers.read(reg);
+        } else if (rob[slot].done) {
+            value = resultOf(rob[slot]);
+        } else {
+            entry.waitsOn[operand] = slot;
+        }
+    }
+    (operand == 0 ? entry.op.rs1Value : entry.op.rs2Value) = value;
+}
+
+void OutOfOrderProcessor::dispatch() {
+    stall = false;
+    if (!ifId.valid) {
+        return;
+    }
+    
+    // a full structure keeps the instruction in IF/ID
+    const Instruction& instr = ifId.instruction;
+    Unit unit = unitOf(instr);
+    if (robCount == sizes.reorderBuffer) {
+        stall = true;
+        robStats.fullCycles++;
+        return;
+    }
+    if (unit == UNIT_MEMORY && loadStoreCount == sizes.loadStoreQueue) {
+        stall = true;
+        loadStoreStats.fullCycles++;
+        return;
+    }
+    if (unit != UNIT_MEMORY && issueCount == sizes.issueQueue) {
+        stall = true;
+        issueStats.fullCycles++;
+        return;
+    }
+    
+    int slot = slotAt(robCount);
+    robCount++;
+    RobEntry& entry = rob[slot];
+    entry.op = ifId;
+    entry.op.isBType = instr.isBType() || instr.isJump();
+    entry.seq = nextSeq++;
+    entry.unit = unit;
+    entry.issued = false;
+    entry.done = false;
+    entry.completeCycle = -1;
+    
+    // rename the sources, then become the newest writer of rd
+    bool usesRs1 = !instr.isUType() && !instr.isJType();
+    bool usesRs2 = usesRs1 && !instr.isIType();
+    readOperand(entry, 0, usesRs1 ? instr.getRs1() : 0);
+    readOperand(entry, 1, usesRs2 ? instr.getRs2() : 0);
+    if (instr.writesRd()) {
+        producer[instr.getRd()] = slot;
+    }
+    
+    if (unit == UNIT_MEMORY) {
+        loadStoreCount++;
+    } else {
+        issueCount++;
+    }
+    if (diagramEnabled) {
+        timeline.push_back({ifId.pc, cycleCount, -1, -1, -1, false});
+    }
+    ifId.clear();
+}
+
+void OutOfOrderProcessor::endCycle() {
+    auto sample = [](Occupancy& stats, int entries) {
+        stats.total += entries;
+        stats.peak = max(stats.peak, entries);
+    };
+    sample(robStats, robCount);
+    sample(issueStats, issueCount);
+    sample(loadStoreStats, loadStoreCount);
+    cycleCount++;
+    
+    if (diagramEnabled && streamWindow > 0 && cycleCount - streamedCycles >= streamWindow) {
+        writeFinishedRows();
+        streamedCycles += streamWindow;
+    }
+}
+
+void OutOfOrderProcessor::finishRun() {
+    if (!diagramEnabled) {
+        return;
+    }
+    if (streamWindow > 0) {
+        // the rest, in-flight instructions included
+        writeFinishedRows();
+        if (!timeline.empty()) {
+            outputBuffer.clear();
+            if (timelineFirst > 0) {
+                outputBuffer += '\n';
+            }
+            formatTimeline(outputBuffer, timeline.size());
+            output->write(outputBuffer.data(), outputBuffer.size());
+        }
+        streamedCycles = cycleCount;
+    } else {
+        outputBuffer.clear();
+        formatTimeline(outputBuffer, timeline.size());
+        output->write(outputBuffer.data(), outputBuffer.size());
+    }
+    output->flush();
+}
+
+void OutOfOrderProcessor::writeFinishedRows() {
+    size_t count = 0;
+    while (count < timeline.size() && finished(timeline[count])) {
+        count++;
+    }
+    if (count == 0) {
+        return;
+    }
+    outputBuffer.clear();
+    if (timelineFirst > 0) {
+        outputBuffer += '\n';
+    }
+    formatTimeline(outputBuffer, count);
+    output->write(outputBuffer.data(), outputBuffer.size());
+    output->flush();
+    timeline.erase(timeline.begin(), timeline.begin() + count);
+    timelineFirst += count;
+}
+
+void OutOfOrderProcessor::formatTimeline(string& out, size_t count) const {
+    // rows of the program only, like the stage diagram
+    vector<string> texts(count);
+    size_t maxInstrLength = 15;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t pc = timeline[i].pc;
+        if (memory.isInstructionAddress(pc)) {
+            texts[i] = stripComments(memory.getAssembly(pc));
+            maxInstrLength = max(maxInstrLength, texts[i].length() + 10); // Add extra space for PC
+            texts[i] += " (" + to_string(pc) + ")";
+        }
+    }
+    const size_t columnWidth = 11;
+    
+    appendPadded(out, "Instruction (PC)", maxInstrLength);
+    for (const char* name : {"Dispatch", "Issue", "Complete", "Commit"}) {
+        appendPadded(out, string("; ") + name, columnWidth);
+    }
+    out += '\n';
+    out.append(maxInstrLength + 4 * columnWidth, '-');
+    out += '\n';
+    
+    auto cell = [](int cycle) { return cycle < 0 ? string("-") : to_string(cycle); };
+    for (size_t i = 0; i < count; i++) {
+        if (texts[i].empty()) {
+            continue;
+        }
+        const TimelineRow& row = timeline[i];
+        appendPadded(out, texts[i], maxInstrLength);
+        for (const string& text : {cell(row.dispatch), cell(row.issue), cell(row.complete),
+                                   row.flushed ? string("flushed") : cell(row.commit)}) {
+            out += "; ";
+            appendPadded(out, text, columnWidth - 2);
+        }
+        out += '\n';
+    }
+}
+
+void OutOfOrderProcessor::writeVariantJson(ostream& out) const {
+    auto occupancy = [&](const char* name, const Occupancy& stats, int size) {
+        out << ", \"" << name << "\": {\"size\": " << size
+            << ", \"average\": " << (cycleCount == 0 ? 0.0 : double(stats.total) / cycleCount)
+            << ", \"peak\": " << stats.peak << ", \"full_cycles\": " << stats.fullCycles << "}";
+    };
+    out << ", \"out_of_order\": {\"dispatched\": " << nextSeq;
+    occupancy("rob", robStats, sizes.reorderBuffer);
+    occupancy("issue_queue", issueStats, sizes.issueQueue);
+    occupancy("load_store_queue", loadStoreStats, sizes.loadStoreQueue);
+    out << "}";
+}
+
+void OutOfOrderProcessor::printVariantStats(ostream& out) const {
+    auto print = [&](const char* name, const Occupancy& stats, int size) {
+        out << fixed << setprecision(1) << name << ": " << (cycleCount == 0 ? 0.0 : double(stats.total) / cycleCount)
+            << " of " << size << " entries on average, peak " << stats.peak << ", full for "
+            << stats.fullCycles << " dispatch cycles\n";
+    };
+    print("Reorder buffer", robStats, sizes.reorderBuffer);
+    print("Issue queue", issueStats, sizes.issueQueue);
+    print("Load/store queue", loadStoreStats, sizes.loadStoreQueue);
+}
+
+void OutOfOrderProcessor::saveVariantState(CheckpointWriter& out, bool includeTracker) const {
+    out.put(sizes);
+    for (const RobEntry& entry : rob) {
+        out.put(entry);
+    }
+    out.put(robHead);
+    out.put(robCount);
+    out.put(issueCount);
+    out.put(loadStoreCount);
+    out.put(producer);
+    out.put(dividerFreeCycle);
+    out.put(nextSeq);
+    out.put(robStats);
+    out.put(issueStats);
+    out.put(loadStoreStats);
+    
+    // without the tracker only the rows that are still in flight
+    size_t skip = 0;
+    while (!includeTracker && skip < timeline.size() && finished(timeline[skip])) {
+        skip++;
+    }
+    out.put(timelineFirst + skip);
+    out.put(static_cast<uint64_t>(timeline.size() - skip));
+    for (size_t i = skip; i < timeline.size(); i++) {
+        out.put(timeline[i]);
+    }
+}
+
+void OutOfOrderProcessor::restoreVariantState(CheckpointReader& in) {
+    QueueSizes saved = in.get<QueueSizes>();
+    if (saved.reorderBuffer != sizes.reorderBuffer || saved.issueQueue != sizes.issueQueue ||
+        saved.loadStoreQueue != sizes.loadStoreQueue) {
+        throw runtime_error("Checkpoint was taken with different queue sizes: " + in.getFilename());
+    }
+    for (RobEntry& entry : rob) {
+        entry = in.get<RobEntry>();
+    }
+    robHead = in.get<int>();
+    robCount = in.get<int>();
+    issueCount = in.get<int>();
+    loadStoreCount = in.get<int>();
+    producer = in.get<array<int, 32>>();
+    dividerFreeCycle = in.get<int>();
+    nextSeq = in.get<uint64_t>();
+    robStats = in.get<Occupancy>();
+    issueStats = in.get<Occupancy>();
+    loadStoreStats = in.get<Occupancy>();
+    
+    timelineFirst = in.get<uint64_t>();
+    timeline.resize(in.get<uint64_t>());
+    for (TimelineRow& row : timeline) {
+        row = in.get<TimelineRow>();
+    }
+}
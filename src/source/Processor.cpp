@@ -1,69 +1,196 @@
 #include "../include/Processor.hpp"
 using namespace std;
-Processor::Processor() : pc(0), cycleCount(0), instructionCount(0), stall(false) {
+Processor::Processor() : pc(0), btpc(0), tibt(false), hartId(0), cycleCount(0), instructionCount(0), stall(false),
+                         predictor(make_unique<NotTakenPredictor>()), fetchWait(0), fetchStarted(false),
+                         memoryWait(0), memoryStarted(false), memoryStall(false),
+                         mulLatency(1), divLatency(1), executeWait(0), executeStarted(false), executeStall(false),
+                         issueWidth(1), haltEnabled(false), haltReason(HaltReason::NONE), haltPc(0), exitCode(0),
+                         diagramEnabled(true), streamWindow(0), streamedCycles(0),
+                         output(&cout) {
+    stageTexts.resize(1 << depth.stages());
 }
 
 void Processor::loadProgram(const string& filename) {
+    loadProgram(ProgramImage::load(filename));
+}
+
+void Processor::loadProgram(shared_ptr<const ProgramImage> image) {
     reset();
-    memory.loadInstructions(filename);
+    memory.setProgram(move(image));
     
-    // load all instructions into the pipeline table
+    // ELF executables give their own entry point and expect a stack
+    const ProgramImage& program = memory.getProgram();
+    pc = program.getEntryPoint();
+    if (program.getFormat() == ProgramImage::Format::ELF) {
+        registers.write(2, STACK_TOP);
+    }
+    
+    // load all instructions into the pipeline table, one row per program
+    // image slot so that row i always belongs to pc textBase + i*4
+    uint32_t textBase = program.getTextBase();
+    pipelineTable.reserve(memory.getInstructionCount());
     for (uint32_t i = 0; i < memory.getInstructionCount(); i++) {
-        uint32_t instrAddr = i * 4;
-        auto instr = memory.getInstruction(instrAddr);
-        string instrText = stripComments(instr.getAssembly());
+        uint32_t instrAddr = textBase + i * 4;
         
-        // Skip empty lines
-        if (instrText.empty()) {
-            continue;
-        }
-        
-        // add all instructions to the tracking table without any stages yet
+        // add all instructions to the tracking table without any stages yet,
+        // the assembly text is only cleaned up when the diagram is printed
         InstructionTracker newTracker;
-        newTracker.assembly = instrText;
         newTracker.pc = instrAddr;  // store the instruction's PC address, multiples of 4
         newTracker.firstCycle = -1;  // -1 -> not yet executed
-        
-        // If this is the first instruction, mark it as in IF stage for cycle 0
-        if (i == 0) {
-            newTracker.firstCycle = 0;
-            newTracker.stages.resize(1, "IF");
-        }
-        
-        pipelineTable.push_back(newTracker);
+        newTracker.pendingOutput = false;
+        pipelineTable.push_back(move(newTracker));
     }
+    
+    // The entry instruction is in IF stage for cycle 0
+    seedFetch();
 }
 
-void Processor::run(int cycles) {
-    for (int i = 0; i < cycles; ++i) {
-        // Execute pipeline stages in reverse order to avoid overwriting
-        stageWB();
-        stageMEM();
-        stageEX();
-        
-        // Detect hazards BEFORE ID and IF stages
-        detectHazards();
-        
-        // Now execute ID and IF, updated stall flag
-        stageID();
-        stageIF();
+void Processor::seedFetch() {
+    if (!memory.isInstructionAddress(pc)) {
+        return;
+    }
+    size_t index = (pc - memory.getProgram().getTextBase()) / 4;
+    InstructionTracker& tracker = pipelineTable[index];
+    tracker.firstCycle = 0;
+    tracker.cells.push_back({0, stageBit(STAGE_IF, 0)});
+    tracker.pendingOutput = true;
+    activeRows.push_back(index);
+}
 
-        
-        // update the pipeline table with current state for the NEXT cycle
-        cycleCount++;
-        updatePipelineTable();
+void Processor::fastForward(uint64_t count) {
+    if (cycleCount > 0) {
+        throw runtime_error("Fast-forward must happen before the pipeline runs");
+    }
+    
+    // execute functionally on the same registers and memory, the latches
+    // are still empty so pc is the whole architectural state besides them
+    FunctionalCore core(registers, memory, pc);
+    core.run(count);
+    
+    // the pipeline then starts fetching where the functional run stopped
+    pc = core.getPc();
+    reseedFetch();
+}
+
+void Processor::reseedFetch() {
+    for (uint32_t row : activeRows) {
+        pipelineTable[row].firstCycle = -1;
+        pipelineTable[row].cells.clear();
+        pipelineTable[row].pendingOutput = false;
+    }
+    activeRows.clear();
+    seedFetch();
+}
+
+Processor::PipelineDepth Processor::PipelineDepth::parse(const string& spec) {
+    PipelineDepth depth;
+    stringstream fields(spec);
+    string field;
+    while (getline(fields, field, ',')) {
+        if (field.empty()) {
+            continue;
+        }
+        size_t equals = field.find('=');
+        if (equals == string::npos) {
+            throw runtime_error("expected key=value, got " + field);
+        }
+        string key = field.substr(0, equals);
+        string value = field.substr(equals + 1);
+        int* stages = key == "if" ? &depth.fetch : key == "ex" ? &depth.execute
+                    : key == "mem" ? &depth.memory : nullptr;
+        if (stages == nullptr) {
+            throw runtime_error("unknown pipeline stage " + key + ", expected if, ex or mem");
+        }
+        size_t used = 0;
+        try {
+            *stages = stoi(value, &used);
+        } catch (const exception&) {
+            used = 0;
+        }
+        if (used == 0 || used != value.length() || *stages < 1 || *stages > MAX) {
+            throw runtime_error(key + " must be 1 to " + to_string(MAX) + " sub-stages");
+        }
+    }
+    return depth;
+}
+
+void Processor::setPipelineDepth(const PipelineDepth& newDepth) {
+    if (cycleCount > 0) {
+        throw runtime_error("The pipeline depth must be set before the pipeline runs");
     }
+    depth = newDepth;
+    fetchLine.assign(depth.fetch - 1, PipelineRegister());
+    executeLine.assign(depth.execute - 1, PipelineRegister());
+    memoryLine.assign(depth.memory - 1, PipelineRegister());
+    stageTexts.assign(1 << depth.stages(), string());
     
-    //print the pipeline diagram at the end
-    printPipelineDiagram();
+    // the cell of cycle 0 was seeded with the bits of the old depth
+    reseedFetch();
+}
+
+PipelineRegister& Processor::advanceLine(vector<PipelineRegister>& line, PipelineRegister& next) {
+    next = line.back();
+    for (size_t i = line.size() - 1; i > 0; i--) {
+        line[i] = line[i - 1];
+    }
+    return line[0];
+}
+
+
+void Processor::endCycle() {
+    // update the pipeline table with current state for the NEXT cycle
+    cycleCount++;
+    if (!diagramEnabled) {
+        return;
+    }
+    updatePipelineTable();
+    streamCompletedWindow();
+}
+
+void Processor::streamCompletedWindow() {
+    // in streaming mode write out every completed window right away
+    if (streamWindow > 0 && cycleCount - streamedCycles >= streamWindow) {
+        flushStreamWindow(streamedCycles + streamWindow);
+    }
+}
+
+void Processor::finishRun() {
+    if (!diagramEnabled) {
+        return;
+    }
+    //print the pipeline diagram at the end (or what is left of it when streaming)
+    if (streamWindow > 0) {
+        flushStreamWindow(cycleCount);
+    } else {
+        printPipelineDiagram();
+    }
+}
+
+void Processor::setStreamWindow(int cycles) {
+    streamWindow = cycles;
 }
 
 void Processor::reset() {
     // all the registers, memory, latches, ALU info cleared
     pc = 0;
+    btpc = 0;
+    tibt = false;
     cycleCount = 0;
     instructionCount = 0;
     stall = false;
+    counters = PerfCounters();
+    fetchWait = 0;
+    fetchStarted = false;
+    memoryWait = 0;
+    memoryStarted = false;
+    memoryStall = false;
+    registerReady.fill(0);
+    executeWait = 0;
+    executeStarted = false;
+    executeStall = false;
+    haltReason = HaltReason::NONE;
+    haltPc = 0;
+    exitCode = 0;
     
     registers.reset();
     memory.reset();
@@ -72,34 +199,361 @@ void Processor::reset() {
     idEx.clear();
     exMem.clear();
     memWb.clear();
+    for (vector<PipelineRegister>* line : {&fetchLine, &executeLine, &memoryLine}) {
+        for (PipelineRegister& latch : *line) {
+            latch.clear();
+        }
+    }
     
     // Clear pipeline table
     pipelineTable.clear();
+    activeRows.clear();
+    streamedCycles = 0;
 }
 
 void Processor::stageIF() {
+    // IF2.. hand their instruction on unless ID holds them, after a
+    // redirect everything they hold is on the wrong path
+    PipelineRegister& fetched = fetchLine.empty() ? ifId : fetchLine[0];
+    if (!fetchLine.empty()) {
+        if (tibt) {
+            for (PipelineRegister& latch : fetchLine) {
+                latch.clear();
+            }
+        } else if (!stall) {
+            ifId = fetchLine.back();
+            for (size_t i = fetchLine.size() - 1; i > 0; i--) {
+                fetchLine[i] = fetchLine[i - 1];
+            }
+        }
+    }
+    
+    if (haltEnabled && !tibt && !memory.isInstructionAddress(pc)) {
+        // a stalled ID keeps its instruction
+        if (!stall) {
+            fetched.clear();
+        }
+        fetchPastEnd();
+        return;
+    }
+    
+    if (icache.enabled() && waitForFetch()) {
+        if (tibt) {
+            // a redirect drops the wrong-path fetch, its line is filled anyway
+            tibt = false;
+            pc = btpc;
+            fetchWait = 0;
+            fetchStarted = false;
+        }
+        // bubble into ID, a stalled ID keeps its instruction
+        if (!stall) {
+            fetched.clear();
+        }
+        return;
+    }
     if (stall) {
         return;
     }
 
-    // Fetch the instruction at the current PC
-    auto instr = memory.getInstruction(pc);
-    
-    // Update IF/ID pipeline register
-    ifId.valid = true;
-    ifId.instruction = make_shared<Instruction>(instr);
-    ifId.pc = pc;
+    // Fetch the instruction at the current PC from the predecoded program image
+    fetched.valid = true;
+    fetched.instruction = *memory.getInstruction(pc);
+    fetched.pc = pc;
 
     // Increment PC
     pc += 4;
+    fetchStarted = false;
 
     //tibt -> this instruction branch taken
     if (tibt) {
-        ifId.clear();
+        fetched.clear();
         tibt = false ; 
         pc = btpc;
+        return;
+    }
+    
+    // follow the predicted path, a correct prediction costs no cycles
+    const Instruction& instr = fetched.instruction;
+    fetched.predictedTaken = false;
+    if (instr.isBType()) {
+        if (predictor->predict(fetched.pc, instr.getImm())) {
+            fetched.predictedTaken = true;
+            fetched.predictedTarget = fetched.pc + instr.getImm();
+        }
+    } else if (instr.isJump()) {
+        fetched.predictedTaken = btb.lookup(fetched.pc, fetched.predictedTarget);
+    }
+    if (fetched.predictedTaken) {
+        pc = fetched.predictedTarget;
+    }
+}
+
+bool Processor::waitForFetch() {
+    // the first attempt to fetch pc looks it up and fills the line on a miss
+    if (!fetchStarted) {
+        fetchWait = icache.access(pc, false);
+        fetchStarted = true;
+    }
+    if (fetchWait == 0) {
+        return false;
+    }
+    fetchWait--;
+    counters.stalls[STALL_ICACHE]++;
+    return true;
+}
+
+bool Processor::waitForData(const PipelineRegister& access) {
+    if (!memoryStarted) {
+        memoryWait = dcache.access(access.aluResult, access.instruction.isSType());
+        memoryStarted = true;
+    }
+    if (memoryWait == 0) {
+        memoryStarted = false;
+        return false;
+    }
+    memoryWait--;
+    counters.stalls[STALL_DCACHE]++;
+    return true;
+}
+
+bool Processor::holdInExecute(const Instruction& instr) {
+    executeStall = false;
+    if (divLatency > 1 && ALU::isDivide(instr.getAluOp())) {
+        // the first cycle starts the divide, the last one finishes it
+        if (!executeStarted) {
+            executeWait = divLatency - 1;
+            executeStarted = true;
+        }
+        if (executeWait > 0) {
+            executeWait--;
+            counters.stalls[STALL_DIVIDE]++;
+            executeStall = true;
+            return true;
+        }
+        executeStarted = false;
     }
+    return false;
+}
 
+int Processor::skipWaitingCycles(int limit) {
+    auto drained = [](const vector<PipelineRegister>& line) {
+        return none_of(line.begin(), line.end(), [](const PipelineRegister& latch) { return latch.valid; });
+    };
+    int count = 0;
+    if (memoryStall) {
+        // data cache miss: EX, ID and IF hold, WB and MEM2.. have nothing
+        if (memoryWait == 0 || memWb.valid || !drained(memoryLine)) {
+            return 0;
+        }
+        count = static_cast<int>(min<uint32_t>(memoryWait, limit));
+        memoryWait -= count;
+        counters.stalls[STALL_DCACHE] += count;
+        counters.bubbles[BUBBLE_ID] += ifId.valid ? 0 : count;
+        counters.bubbles[BUBBLE_EX] += idEx.valid ? 0 : count;
+        counters.bubbles[BUBBLE_WB] += count;
+    } else if (executeStall) {
+        // divider: ID and IF hold, everything ahead of EX is empty
+        if (executeWait == 0 || memWb.valid || exMem.valid || !drained(memoryLine) || !drained(executeLine)) {
+            return 0;
+        }
+        count = min(executeWait, limit);
+        executeWait -= count;
+        counters.stalls[STALL_DIVIDE] += count;
+        counters.bubbles[BUBBLE_ID] += ifId.valid ? 0 : count;
+        counters.bubbles[BUBBLE_MEM] += count;
+        counters.bubbles[BUBBLE_WB] += count;
+    } else {
+        // instruction cache miss and nothing else in the pipeline
+        if (fetchWait == 0 || stall || tibt || !pipelineEmpty() ||
+            (haltEnabled && !memory.isInstructionAddress(pc))) {
+            return 0;
+        }
+        count = static_cast<int>(min<uint32_t>(fetchWait, limit));
+        fetchWait -= count;
+        counters.stalls[STALL_ICACHE] += count;
+        for (uint64_t& bubbles : counters.bubbles) {
+            bubbles += count;
+        }
+    }
+    
+    // no stage shows an instruction in these cycles, only the windows they
+    // complete are written out
+    if (!diagramEnabled) {
+        cycleCount += count;
+        return count;
+    }
+    for (int i = 0; i < count; i++) {
+        cycleCount++;
+        streamCompletedWindow();
+    }
+    return count;
+}
+
+void Processor::markResultReady(const Instruction& instr) {
+    if (mulLatency > 1 && instr.writesRd()) {
+        // a later write of the same register is ready after one cycle again
+        registerReady[instr.getRd()] = cycleCount + (ALU::isMultiply(instr.getAluOp()) ? mulLatency : 1);
+    }
+}
+
+bool Processor::waitsForMultiplier(const Instruction& instr) const {
+    if (mulLatency <= 1) {
+        return false;
+    }
+    // ID now, EX next cycle at the earliest
+    int exCycle = cycleCount + 1;
+    bool usesRs2 = !instr.isIType() && !instr.isUType() && !instr.isJType();
+    return registerReady[instr.getRs1()] > exCycle || (usesRs2 && registerReady[instr.getRs2()] > exCycle);
+}
+
+bool Processor::resolveBranch(const PipelineRegister& branch, bool taken, uint32_t target, int penalty) {
+    bool mispredicted = taken != branch.predictedTaken || (taken && target != branch.predictedTarget);
+    if (branch.instruction.isBType()) {
+        counters.branches++;
+        counters.branchMisses += mispredicted;
+        predictor->update(branch.pc, taken);
+    } else {
+        counters.jumps++;
+        counters.jumpMisses += mispredicted;
+        btb.update(branch.pc, target);
+    }
+    if (mispredicted) {
+        // plus what IF2.. hold, stageIF drops them with the redirect
+        counters.flushCycles += penalty + depth.fetch - 1;
+    }
+    return mispredicted;
+}
+
+void Processor::printBranchStats(ostream& out) const {
+    auto percent = [](uint64_t misses, uint64_t total) {
+        return total == 0 ? 100.0 : 100.0 * (total - misses) / total;
+    };
+    out << fixed << setprecision(1)
+        << "Branch predictor " << predictor->name() << (btb.enabled() ? " + BTB" : "") << ": "
+        << counters.branches << " branches (" << percent(counters.branchMisses, counters.branches)
+        << "% correct), " << counters.jumps << " jumps ("
+        << percent(counters.jumpMisses, counters.jumps) << "% correct), "
+        << counters.flushes() << " flushes costing " << counters.flushCycles << " cycles\n";
+}
+
+void Processor::printCacheStats(ostream& out) const {
+    auto print = [&out](const char* name, const Cache& cache, uint64_t stallCycles) {
+        uint64_t accesses = cache.getHits() + cache.getMisses();
+        out << fixed << setprecision(1) << name << ": " << accesses << " accesses, "
+            << (accesses == 0 ? 0.0 : 100.0 * cache.getMisses() / accesses) << "% misses, "
+            << cache.getWriteBacks() << " write-backs, " << stallCycles << " stall cycles\n";
+    };
+    if (icache.enabled()) {
+        print("I-cache", icache, counters.stalls[STALL_ICACHE]);
+    }
+    if (dcache.enabled()) {
+        print("D-cache", dcache, counters.stalls[STALL_DCACHE]);
+    }
+}
+
+// reason in the JSON report, "limit" when the cycle limit ended the run
+static const char* haltReasonName(int reason) {
+    static const char* names[] = {"limit", "ecall", "ebreak", "end"};
+    return names[reason];
+}
+
+void Processor::writeCountersJson(ostream& out) const {
+    auto ratio = [](double a, double b) { return b == 0 ? 0.0 : a / b; };
+    out << fixed << setprecision(4)
+        << "{\"cycles\": " << cycleCount
+        << ", \"instructions\": " << instructionCount
+        << ", \"cpi\": " << ratio(cycleCount, instructionCount)
+        << ", \"ipc\": " << ratio(instructionCount, cycleCount)
+        << ", \"stalls\": {\"total\": " << counters.stallCycles()
+        << ", \"raw_ex\": " << counters.stalls[STALL_RAW_EX]
+        << ", \"raw_mem\": " << counters.stalls[STALL_RAW_MEM]
+        << ", \"raw_wb\": " << counters.stalls[STALL_RAW_WB]
+        << ", \"load_use\": " << counters.stalls[STALL_LOAD_USE]
+        << ", \"icache\": " << counters.stalls[STALL_ICACHE]
+        << ", \"dcache\": " << counters.stalls[STALL_DCACHE]
+        << ", \"multiply\": " << counters.stalls[STALL_MULTIPLY]
+        << ", \"divide\": " << counters.stalls[STALL_DIVIDE] << "}"
+        << ", \"issue\": {\"width\": " << issueWidth
+        << ", \"dual\": " << counters.dualIssues
+        << ", \"split\": " << counters.splitIssues << "}"
+        << ", \"depth\": {\"if\": " << depth.fetch
+        << ", \"ex\": " << depth.execute
+        << ", \"mem\": " << depth.memory
+        << ", \"stages\": " << depth.stages() << "}"
+        << ", \"bubbles\": {\"id\": " << counters.bubbles[BUBBLE_ID]
+        << ", \"ex\": " << counters.bubbles[BUBBLE_EX]
+        << ", \"mem\": " << counters.bubbles[BUBBLE_MEM]
+        << ", \"wb\": " << counters.bubbles[BUBBLE_WB] << "}"
+        << ", \"flushes\": {\"count\": " << counters.flushes()
+        << ", \"cycles\": " << counters.flushCycles << "}"
+        << ", \"branches\": {\"predictor\": \"" << predictor->name() << "\""
+        << ", \"btb_entries\": " << btb.size()
+        << ", \"conditional\": " << counters.branches
+        << ", \"conditional_mispredicted\": " << counters.branchMisses
+        << ", \"jumps\": " << counters.jumps
+        << ", \"jumps_mispredicted\": " << counters.jumpMisses << "}"
+        << ", \"memory\": {\"loads\": " << counters.loads
+        << ", \"stores\": " << counters.stores
+        << ", \"misaligned\": " << memory.getMisalignedAccesses() << "}";
+    auto cacheJson = [&out](const char* name, const Cache& cache) {
+        out << ", \"" << name << "\": ";
+        if (!cache.enabled()) {
+            out << "null";
+            return;
+        }
+        out << "{\"hits\": " << cache.getHits() << ", \"misses\": " << cache.getMisses()
+            << ", \"writebacks\": " << cache.getWriteBacks() << "}";
+    };
+    cacheJson("icache", icache);
+    cacheJson("dcache", dcache);
+    out << ", \"halt\": ";
+    if (haltEnabled) {
+        out << "{\"reason\": \"" << haltReasonName(static_cast<int>(haltReason)) << "\", \"pc\": " << haltPc
+            << ", \"exit_code\": " << getExitStatus() << "}";
+    } else {
+        out << "null";
+    }
+    writeVariantJson(out);
+    out << "}";
+}
+
+bool Processor::pipelineEmpty() const {
+    if (ifId.valid || idEx.valid || exMem.valid || memWb.valid) {
+        return false;
+    }
+    for (const vector<PipelineRegister>* line : {&fetchLine, &executeLine, &memoryLine}) {
+        for (const PipelineRegister& latch : *line) {
+            if (latch.valid) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Processor::fetchPastEnd() {
+    // the stages ran this cycle, so empty latches mean the last instruction
+    // left WB in this cycle
+    if (pipelineEmpty()) {
+        haltReason = HaltReason::END;
+    }
+}
+
+void Processor::printHaltReport(ostream& out) const {
+    switch (haltReason) {
+        case HaltReason::ECALL:
+        case HaltReason::EBREAK:
+            out << (haltReason == HaltReason::ECALL ? "ecall" : "ebreak") << " at pc " << haltPc
+                << " retired in cycle " << cycleCount - 1 << ", exit code " << getExitStatus() << "\n";
+            break;
+        case HaltReason::END:
+            out << "Ran past the end of the program, the pipeline drained after "
+                << cycleCount << " cycles\n";
+            break;
+        default:
+            out << "No ecall/ebreak within " << cycleCount << " cycles\n";
+            break;
+    }
 }
 
 void Processor::stageID() {
@@ -118,24 +572,26 @@ void Processor::stageID() {
     idEx.instruction = ifId.instruction;
     idEx.pc = ifId.pc;
     idEx.valid = true;
+    idEx.predictedTaken = ifId.predictedTaken;
+    idEx.predictedTarget = ifId.predictedTarget;
     
     // Read register values
-    auto instr = idEx.instruction;
-    idEx.rs1Value = registers.read(instr->getRs1());
-    idEx.rs2Value = registers.read(instr->getRs2());
+    const Instruction& instr = idEx.instruction;
+    idEx.rs1Value = registers.read(instr.getRs1());
+    idEx.rs2Value = registers.read(instr.getRs2());
     
     // Check if this is a branch instruction and calculate target
-    if (instr->isBType() || instr->isJump()) {
+    if (instr.isBType() || instr.isJump()) {
         idEx.isBType = true;
-        if (instr->isBType()) {
-            idEx.branchTarget = idEx.pc + instr->getImm();
-        } else if (instr->getOpcode() == 0x6F) { 
+        if (instr.isBType()) {
+            idEx.branchTarget = idEx.pc + instr.getImm();
+        } else if (instr.getOpcode() == 0x6F) { 
             // JAL
-            idEx.branchTarget = idEx.pc + instr->getImm();
+            idEx.branchTarget = idEx.pc + instr.getImm();
             idEx.branchTaken = true; // JAL always takes the jump
-        } else if (instr->getOpcode() == 0x67) { 
+        } else if (instr.getOpcode() == 0x67) { 
             // JALR
-            idEx.branchTarget = (idEx.rs1Value + instr->getImm()) & ~1;
+            idEx.branchTarget = (idEx.rs1Value + instr.getImm()) & ~1;
             idEx.branchTaken = true; 
             // JALR always takes the jump
         }
@@ -146,42 +602,16 @@ void Processor::stageID() {
     }
     
     // For branches, evaluate condition
-    if (instr->isBType()) {
-        int funct3 = instr->getFunct3();
-        int rs1Val = idEx.rs1Value;
-        int rs2Val = idEx.rs2Value;
-        
-        switch (funct3) {
-            case 0x0: // BEQ
-                idEx.branchTaken = (rs1Val == rs2Val);
-                break;
-            case 0x1: // BNE
-                idEx.branchTaken = (rs1Val != rs2Val);
-                break;
-            case 0x4: // BLT
-                idEx.branchTaken = (rs1Val < rs2Val);
-                break;
-            case 0x5: // BGE
-                idEx.branchTaken = (rs1Val >= rs2Val);
-                break;
-            case 0x6: // BLTU
-                idEx.branchTaken = ((unsigned int)rs1Val < (unsigned int)rs2Val);
-                break;
-            case 0x7: // BGEU
-                idEx.branchTaken = ((unsigned int)rs1Val >= (unsigned int)rs2Val);
-                break;
-            default:
-                idEx.branchTaken = false;
-                break;
-        }
-    }
-    
-    // branch prediction (always-not-taken prediction)
-    if (idEx.isBType && idEx.branchTaken) {
-        // wrong prediction, branch is taken, flush and redirect
+    if (instr.isBType()) {
+        idEx.branchTaken = ALU::branchTaken(instr.getFunct3(), idEx.rs1Value, idEx.rs2Value);
+    }
+    
+    // check the prediction made in IF, one wrong-path fetch to flush
+    if (idEx.isBType && resolveBranch(idEx, idEx.branchTaken, idEx.branchTarget, 1)) {
+        // wrong prediction, flush and redirect
         ifId.clear();
-        // btpc -> branch taken pc
-        btpc = idEx.branchTarget;
+        // btpc -> resolved next pc
+        btpc = idEx.branchTaken ? idEx.branchTarget : idEx.pc + 4;
         tibt = true ; 
     }
 
@@ -189,282 +619,102 @@ void Processor::stageID() {
 }
 
 void Processor::stageEX() {
+    // EX1 writes exMem, or the first latch of the EX sub-stages
+    PipelineRegister& out = advanceExecute();
     if (!idEx.valid) {
-        exMem.clear();
+        out.clear();
         return;
     }
+    if (holdInExecute(idEx.instruction)) {
+        out.clear();
+        return;
+    }
+    markResultReady(idEx.instruction);
     
     // Copy values from ID/EX to EX/MEM
-    exMem.instruction = idEx.instruction;
-    exMem.pc = idEx.pc;
-    exMem.valid = true;
-    exMem.rs1Value = idEx.rs1Value;
-    exMem.rs2Value = idEx.rs2Value;
-    exMem.isBType = idEx.isBType;
-    exMem.branchTaken = idEx.branchTaken;
-    exMem.branchTarget = idEx.branchTarget;
-    
-    // Execute ALU operation
-    auto instr = exMem.instruction;
-    int aluResult = 0;
-    
-    if (instr->isRType()) {
-        int funct3 = instr->getFunct3();
-        int funct7 = instr->getFunct7();
-        
-        // Check if this is an M-extension instruction (MUL/DIV/REM)
-        if (funct7 == 0x01) {
-            switch (funct3) {
-                case 0x0: // MUL
-                    aluResult = idEx.rs1Value * idEx.rs2Value;
-                    break;
-                case 0x1: // MULH
-                    // Signed * Signed -> High bits
-                    {
-                        int64_t a = static_cast<int64_t>(idEx.rs1Value);
-                        int64_t b = static_cast<int64_t>(idEx.rs2Value);
-                        int64_t result = a * b;
-                        aluResult = static_cast<int>(result >> 32);
-                    }
-                    break;
-                case 0x2: // MULHSU
-                    // Signed * Unsigned -> High bits
-                    {
-                        int64_t a = static_cast<int64_t>(idEx.rs1Value);
-                        uint64_t b = static_cast<uint64_t>(static_cast<uint32_t>(idEx.rs2Value));
-                        int64_t result = a * b;
-                        aluResult = static_cast<int>(result >> 32);
-                    }
-                    break;
-                case 0x3: // MULHU
-                    // Unsigned * Unsigned -> High bits
-                    {
-                        uint64_t a = static_cast<uint64_t>(static_cast<uint32_t>(idEx.rs1Value));
-                        uint64_t b = static_cast<uint64_t>(static_cast<uint32_t>(idEx.rs2Value));
-                        uint64_t result = a * b;
-                        aluResult = static_cast<int>(result >> 32);
-                    }
-                    break;
-                case 0x4: // DIV
-                    // Check for division by zero
-                    if (idEx.rs2Value == 0) {
-                        aluResult = -1; // As per spec: division by zero returns -1
-                    } 
-                    // Check for overflow condition (INT_MIN / -1)
-                    else if (idEx.rs1Value == INT_MIN && idEx.rs2Value == -1) {
-                        aluResult = INT_MIN; // Return INT_MIN as specified
-                    } 
-                    else {
-                        aluResult = idEx.rs1Value / idEx.rs2Value;
-                    }
-                    break;
-                case 0x5: // DIVU
-                    // Unsigned division
-                    if (idEx.rs2Value == 0) {
-                        aluResult = 0xFFFFFFFF; // Max unsigned value for division by zero
-                    } else {
-                        aluResult = static_cast<int>((static_cast<uint32_t>(idEx.rs1Value) / 
-                                                     static_cast<uint32_t>(idEx.rs2Value)));
-                    }
-                    break;
-                case 0x6: // REM
-                    // Remainder of signed division
-                    if (idEx.rs2Value == 0) {
-                        aluResult = idEx.rs1Value; // Remainder of x/0 is x
-                    } 
-                    // Handle overflow case (INT_MIN % -1)
-                    else if (idEx.rs1Value == INT_MIN && idEx.rs2Value == -1) {
-                        aluResult = 0; // Remainder is 0 in this case
-                    } 
-                    else {
-                        aluResult = idEx.rs1Value % idEx.rs2Value;
-                    }
-                    break;
-                case 0x7: // REMU
-                    // Remainder of unsigned division
-                    if (idEx.rs2Value == 0) {
-                        aluResult = idEx.rs1Value; // Remainder of x/0 is x
-                    } else {
-                        aluResult = static_cast<int>((static_cast<uint32_t>(idEx.rs1Value) % 
-                                                     static_cast<uint32_t>(idEx.rs2Value)));
-                    }
-                    break;
-            }
-        } else {
-            // Regular R-type instructions
-            switch (funct3) {
-                case 0x0: // ADD/SUB
-                    if (funct7 == 0x00)
-                        aluResult = idEx.rs1Value + idEx.rs2Value; // ADD
-                    else if (funct7 == 0x20)
-                        aluResult = idEx.rs1Value - idEx.rs2Value; // SUB
-                    break;
-                case 0x1: // SLL
-                    aluResult = idEx.rs1Value << (idEx.rs2Value & 0x1F);
-                    break;
-                case 0x2: // SLT
-                    aluResult = (idEx.rs1Value < idEx.rs2Value) ? 1 : 0;
-                    break;
-                case 0x3: // SLTU
-                    aluResult = ((unsigned int)idEx.rs1Value < (unsigned int)idEx.rs2Value) ? 1 : 0;
-                    break;
-                case 0x4: // XOR
-                    aluResult = idEx.rs1Value ^ idEx.rs2Value;
-                    break;
-                case 0x5: // SRL/SRA
-                    if (funct7 == 0x00)
-                        aluResult = (unsigned int)idEx.rs1Value >> (idEx.rs2Value & 0x1F); // SRL
-                    else if (funct7 == 0x20)
-                        aluResult = idEx.rs1Value >> (idEx.rs2Value & 0x1F); // SRA
-                    break;
-                case 0x6: // OR
-                    aluResult = idEx.rs1Value | idEx.rs2Value;
-                    break;
-                case 0x7: // AND
-                    aluResult = idEx.rs1Value & idEx.rs2Value;
-                    break;
-            }
-        }
-    } else if (instr->isIType()) {
-        int funct3 = instr->getFunct3();
-        int imm = instr->getImm();
-        
-        if (instr->getOpcode() == 0x13) { // ALU with immediate
-            switch (funct3) {
-                case 0x0: // ADDI
-                    aluResult = idEx.rs1Value + imm;
-                    break;
-                case 0x2: // SLTI
-                    aluResult = (idEx.rs1Value < imm) ? 1 : 0;
-                    break;
-                case 0x3: // SLTIU
-                    aluResult = ((unsigned int)idEx.rs1Value < (unsigned int)imm) ? 1 : 0;
-                    break;
-                case 0x4: // XORI
-                    aluResult = idEx.rs1Value ^ imm;
-                    break;
-                case 0x6: // ORI
-                    aluResult = idEx.rs1Value | imm;
-                    break;
-                case 0x7: // ANDI
-                    aluResult = idEx.rs1Value & imm;
-                    break;
-                case 0x1: // SLLI
-                    aluResult = idEx.rs1Value << (imm & 0x1F);
-                    break;
-                case 0x5: // SRLI/SRAI
-                    if ((imm >> 5) == 0)
-                        aluResult = (unsigned int)idEx.rs1Value >> (imm & 0x1F); // SRLI
-                    else
-                        aluResult = idEx.rs1Value >> (imm & 0x1F); // SRAI
-                    break;
-            }
-        } else if (instr->getOpcode() == 0x03) { // Load
-            // Calculate memory address
-            aluResult = idEx.rs1Value + imm;
-        } else if (instr->getOpcode() == 0x67) { // JALR
-            // Store return address (PC+4)
-            aluResult = idEx.pc + 4;
-        }
-    } else if (instr->isSType()) { // Store
-        // Calculate memory address
-        aluResult = idEx.rs1Value + instr->getImm();
-    } else if (instr->isBType()) { // Branch
-        // ALU result not used for branches
-    } else if (instr->isUType()) {
-        if (instr->getOpcode() == 0x37) { // LUI
-            aluResult = instr->getImm();
-        } else if (instr->getOpcode() == 0x17) { // AUIPC
-            aluResult = idEx.pc + instr->getImm();
-        }
-    } else if (instr->isJType()) { // JAL
-        // Store return address (PC+4)
-        aluResult = idEx.pc + 4;
-    }
+    out.instruction = idEx.instruction;
+    out.pc = idEx.pc;
+    out.valid = true;
+    out.rs1Value = idEx.rs1Value;
+    out.rs2Value = idEx.rs2Value;
+    out.isBType = idEx.isBType;
+    out.branchTaken = idEx.branchTaken;
+    out.branchTarget = idEx.branchTarget;
     
-    exMem.aluResult = aluResult;
-
+    // Execute ALU operation, the op was resolved at decode
+    const Instruction& instr = out.instruction;
+    out.aluResult = ALU::execute(instr.getAluOp(), idEx.rs1Value, idEx.rs2Value, instr.getImm(), idEx.pc);
+    if (instr.getAluOp() == AluOp::HARTID) {
+        out.aluResult = hartId;
+    }
 }
 
 void Processor::stageMEM() {
+    memoryStall = false;
+    // MEM1 writes memWb, or the first latch of the MEM sub-stages
+    PipelineRegister& out = advanceMemory();
     if (!exMem.valid) {
-        memWb.clear();
+        out.clear();
         return;
     }
     
+    // a data cache miss keeps the access here, the next stage gets a bubble
+    const Instruction& access = exMem.instruction;
+    if (dcache.enabled() && (access.isLoad() || access.isSType()) && waitForData(exMem)) {
+        out.clear();
+        memoryStall = true;
+        return;
+    }
+    accessMemory(exMem, out);
+}
+
+void Processor::accessMemory(const PipelineRegister& from, PipelineRegister& to) {
     // Copy values from EX/MEM to MEM/WB
-    memWb.instruction = exMem.instruction;
-    memWb.pc = exMem.pc;
-    memWb.valid = true;
-    memWb.aluResult = exMem.aluResult;
+    to.instruction = from.instruction;
+    to.pc = from.pc;
+    to.valid = true;
+    to.aluResult = from.aluResult;
     
-    auto instr = memWb.instruction;
+    const Instruction& instr = to.instruction;
     
     // Memory operations
-    if (instr->isLoad()) {
-        int funct3 = instr->getFunct3();
-        uint32_t address = exMem.aluResult;
-        
-        switch (funct3) {
-            case 0x0: // LB - Load Byte
-                memWb.readData = (int8_t)memory.readByte(address);
-                break;
-            case 0x1: // LH - Load Half
-                memWb.readData = (int16_t)memory.readHalf(address);
-                break;
-            case 0x2: // LW - Load Word
-                memWb.readData = (int32_t)memory.readWord(address);
-                break;
-            case 0x4: // LBU - Load Byte Unsigned
-                memWb.readData = memory.readByte(address);
-                break;
-            case 0x5: // LHU - Load Half Unsigned
-                memWb.readData = memory.readHalf(address);
-                break;
-        }
-    } else if (instr->isSType()) {
-        int funct3 = instr->getFunct3();
-        uint32_t address = exMem.aluResult;
-        int value = exMem.rs2Value;
-        
-        switch (funct3) {
-            case 0x0: // SB - Store Byte
-                memory.writeByte(address, value & 0xFF);
-                break;
-            case 0x1: // SH - Store Half
-                memory.writeHalf(address, value & 0xFFFF);
-                break;
-            case 0x2: // SW - Store Word
-                memory.writeWord(address, value);
-                break;
-        }
+    if (instr.isLoad()) {
+        to.readData = memory.load(instr.getFunct3(), from.aluResult);
+        counters.loads++;
+    } else if (instr.isSType()) {
+        memory.store(instr.getFunct3(), from.aluResult, from.rs2Value);
+        counters.stores++;
     }
-
 }
 
 void Processor::stageWB() {
     if (!memWb.valid) {
         return;
     }
+    writeBack(memWb);
+}
+
+void Processor::writeBack(const PipelineRegister& latch) {
+    const Instruction& instr = latch.instruction;
+    instructionCount++;
+    if (haltEnabled && (instr.isEcall() || instr.isEbreak())) {
+        // the run loop stops right after this, younger instructions never retire
+        haltReason = instr.isEcall() ? HaltReason::ECALL : HaltReason::EBREAK;
+        haltPc = latch.pc;
+        exitCode = registers.read(10);
+        return;
+    }
     
-    auto instr = memWb.instruction;
-    int rdNum = instr->getRd();
-    
-    // Write back result to register file
-    if (instr->isLoad()) {
-        registers.write(rdNum, memWb.readData);
-    } else if (instr->isRType() || 
-              (instr->isIType() && instr->getOpcode() == 0x13) || // ALU immediate
-              instr->isUType() || 
-              instr->isJump()) {
-        registers.write(rdNum, memWb.aluResult);
+    // Write back result to register file (flag precomputed at decode)
+    if (instr.writesRd()) {
+        registers.write(instr.getRd(), instr.isLoad() ? latch.readData : latch.aluResult);
     }
 }
 
 //function to strip comments
-string Processor::stripComments(const string& assembly) {
+string Processor::stripComments(string_view assembly) {
     // Find position of comment start
-    string result = assembly;
+    string result(assembly);
     size_t commentPos = result.find('#');
     if (commentPos != string::npos) {
         result = result.substr(0, commentPos);
@@ -504,155 +754,441 @@ void Processor::updatePipelineTable() {
     // Instruction in WB stage
     if (memWb.valid) {
         uint32_t instrPC = memWb.pc;
-        updateInstructionStage(instrPC, "WB");
+        updateInstructionStage(instrPC, STAGE_WB);
+    }
+    
+    // MEM2.. move on while MEM1 waits
+    for (size_t i = 0; i < memoryLine.size(); i++) {
+        if (memoryLine[i].valid) {
+            updateInstructionStage(memoryLine[i].pc, STAGE_MEM, i + 1);
+        }
+    }
+    
+    // held by a data cache miss, every stage behind it shows "-" like a stall
+    if (memoryStall) {
+        return;
     }
     
     // Instruction in MEM stage
     if (exMem.valid) {
         uint32_t instrPC = exMem.pc;
-        updateInstructionStage(instrPC, "MEM");
+        updateInstructionStage(instrPC, STAGE_MEM);
+    }
+    
+    // EX2.. move on while the divider holds EX1
+    for (size_t i = 0; i < executeLine.size(); i++) {
+        if (executeLine[i].valid) {
+            updateInstructionStage(executeLine[i].pc, STAGE_EX, i + 1);
+        }
+    }
+    
+    // held by the divider, EX and the stages behind it show "-"
+    if (executeStall) {
+        return;
     }
     
     // Instruction in EX stage
     if (idEx.valid) {
         uint32_t instrPC = idEx.pc;
-        updateInstructionStage(instrPC, "EX");
+        updateInstructionStage(instrPC, STAGE_EX);
     }
     
     // Instruction in ID stage - Only update if not stalled
     if (ifId.valid && !stall) {
         uint32_t instrPC = ifId.pc;
-        updateInstructionStage(instrPC, "ID");
+        updateInstructionStage(instrPC, STAGE_ID);
+    }
+    if (stall) {
+        return;
     }
     
-    // Instruction in IF stage
-    if (!stall && pc < memory.getInstructionCount() * 4) {
+    // IF2.., held along with ID
+    for (size_t i = 0; i < fetchLine.size(); i++) {
+        if (fetchLine[i].valid) {
+            updateInstructionStage(fetchLine[i].pc, STAGE_IF, i + 1);
+        }
+    }
+    
+    // Instruction in IF stage, not while it waits for the instruction cache
+    if (!fetchStarted && memory.isInstructionAddress(pc)) {
         // pc must be valid
-        updateInstructionStage(pc, "IF");
+        updateInstructionStage(pc, STAGE_IF);
+    }
+}
+
+uint16_t Processor::stageBit(Stage stage, int sub) const {
+    // WB, then each stage's sub-stages from the last to the first
+    int position = 0;
+    switch (stage) {
+        case STAGE_WB:
+            position = 0;
+            break;
+        case STAGE_MEM:
+            position = depth.memory - sub;
+            break;
+        case STAGE_EX:
+            position = depth.memory + depth.execute - sub;
+            break;
+        case STAGE_ID:
+            position = depth.memory + depth.execute + 1;
+            break;
+        case STAGE_IF:
+            position = depth.memory + depth.execute + 1 + depth.fetch - sub;
+            break;
+    }
+    return 1 << position;
+}
+
+void Processor::updateInstructionStage(uint32_t pc, Stage stage, int sub) {
+    // Rows are indexed by pc/4, so this is a direct lookup. Only non-empty
+    // cells are stored, anything else prints as "-".
+    size_t index = (pc - memory.getProgram().getTextBase()) / 4;
+    if (index >= pipelineTable.size()) {
+        return;
+    }
+    InstructionTracker& tracker = pipelineTable[index];
+    
+    if (tracker.firstCycle == -1) {
+        tracker.firstCycle = cycleCount;
     }
     
-    for (auto& tracker : pipelineTable) {
-        if (tracker.stages.size() <= static_cast<size_t>(cycleCount)) {
-            tracker.stages.resize(cycleCount + 1, "-");
+    // cells for this cycle and the previous one, if any were recorded
+    vector<StageCell>& cells = tracker.cells;
+    StageCell* current = nullptr;
+    uint16_t previous = 0;
+    uint16_t bit = stageBit(stage, sub);
+    size_t n = cells.size();
+    if (n > 0 && cells[n - 1].cycle == cycleCount) {
+        current = &cells[n - 1];
+        if (n > 1 && cells[n - 2].cycle == cycleCount - 1) {
+            previous = cells[n - 2].stages;
         }
+    } else if (n > 0 && cells[n - 1].cycle == cycleCount - 1) {
+        previous = cells[n - 1].stages;
+    }
+    
+    // an instruction sitting in the same single stage again shows "-"
+    bool sameAsPrevious = (cycleCount > 0 && previous == bit);
+    if (sameAsPrevious) {
+        return;
+    }
+    
+    if (current == nullptr) {
+        cells.push_back({cycleCount, bit});
+        if (!tracker.pendingOutput) {
+            tracker.pendingOutput = true;
+            activeRows.push_back(index);
+        }
+    } else {
+        current->stages |= bit;
     }
 }
 
-void Processor::updateInstructionStage(uint32_t pc, const string& stage) {
-    // Find the instruction with matching PC in the table
-    for (auto& tracker : pipelineTable) {
-        if (tracker.pc == pc) {
-            if (tracker.firstCycle == -1) {
-                tracker.firstCycle = cycleCount;
-            }
-            
-            // stages vector is completed till the current cycle
-            if (tracker.stages.size() <= static_cast<size_t>(cycleCount)) {
-                tracker.stages.resize(cycleCount + 1, "-");
-            }
-            
-            bool sameAsPrevious = false;
-            if (cycleCount > 0 && tracker.stages.size() > static_cast<size_t>(cycleCount - 1)) {
-                sameAsPrevious = (tracker.stages[cycleCount - 1] == stage);
-            }
-            
-            if (tracker.stages[cycleCount] == "-") {
-                if (sameAsPrevious) {
-                    tracker.stages[cycleCount] = "-";
-                } else {
-                    tracker.stages[cycleCount] = stage;
-                }
-            } else {
-                if (!sameAsPrevious) {
-                    tracker.stages[cycleCount] += "/" + stage;
-                }
+const string& Processor::stageText(uint16_t stages) const {
+    // each mask is formatted once, cells are only turned into text here
+    string& text = stageTexts[stages];
+    if (!text.empty()) {
+        return text;
+    }
+    if (stages == 0) {
+        text = "-";
+        return text;
+    }
+    
+    // names in bit order, see stageBit
+    vector<string> names = {"WB"};
+    auto addStage = [&names](const char* name, int count) {
+        for (int sub = count; sub >= 1; sub--) {
+            names.push_back(count == 1 ? string(name) : name + to_string(sub));
+        }
+    };
+    addStage("MEM", depth.memory);
+    addStage("EX", depth.execute);
+    addStage("ID", 1);
+    addStage("IF", depth.fetch);
+    for (size_t bit = 0; bit < names.size(); bit++) {
+        if (stages & (1 << bit)) {
+            if (!text.empty()) {
+                text += "/";
             }
-            return;
+            text += names[bit];
         }
     }
-    
-    // If somehow the instruction wasn't preloaded, add it now
-    if (pc < memory.getInstructionCount() * 4) {
-        auto instr = memory.getInstruction(pc);
-        string instrText = stripComments(instr.getAssembly());
-        
-        InstructionTracker newTracker;
-        newTracker.assembly = instrText;
-        newTracker.pc = pc;
-        newTracker.firstCycle = cycleCount;
-        newTracker.stages.resize(cycleCount + 1, "-");
-        newTracker.stages[cycleCount] = stage;
-        pipelineTable.push_back(newTracker);
+    return text;
+}
+
+void Processor::appendPadded(string& out, const string& text, size_t width) {
+    // same as cout << left << setw(width) << text, never truncates
+    out += text;
+    if (text.length() < width) {
+        out.append(width - text.length(), ' ');
     }
 }
 
-void Processor::printPipelineDiagram() {
+void Processor::formatDiagram(string& out, int from, int to, const vector<uint32_t>& rows,
+                              size_t maxStageLength) const {
     // Find the maximum length of any assembly instruction for alignment
+    vector<string> texts;
+    texts.reserve(rows.size());
     size_t maxInstrLength = 15;
-    for (const auto& tracker : pipelineTable) {
-        maxInstrLength = max(maxInstrLength, tracker.assembly.length() + 10); // Add extra space for PC
+    for (uint32_t row : rows) {
+        texts.push_back(stripComments(memory.getAssembly(pipelineTable[row].pc)));
+        maxInstrLength = max(maxInstrLength, texts.back().length() + 10); // Add extra space for PC
+    }
+    
+    // Define the column width based on the longest stage
+    const size_t cycleColWidth = maxStageLength + 3; 
+    
+    // Print cycle numbers at the top
+    appendPadded(out, "Instruction (PC)", maxInstrLength);
+    for (int i = from; i < to; i++) {
+        appendPadded(out, "; C" + to_string(i), cycleColWidth);
     }
+    out += '\n';
     
+    // Print a separator line
+    out.append(maxInstrLength + (to - from) * cycleColWidth, '-');
+    out += '\n';
+    
+    for (size_t r = 0; r < rows.size(); r++) {
+        const InstructionTracker& tracker = pipelineTable[rows[r]];
+        // Format instruction with PC
+        appendPadded(out, texts[r] + " (" + to_string(tracker.pc) + ")", maxInstrLength);
+        
+        // Add each stage for each cycle, walking the sparse cells alongside
+        const vector<StageCell>& cells = tracker.cells;
+        size_t next = 0;
+        while (next < cells.size() && cells[next].cycle < from) {
+            next++;
+        }
+        for (int i = from; i < to; i++) {
+            const string* stage = &stageText(0);
+            if (next < cells.size() && cells[next].cycle == i) {
+                stage = &stageText(cells[next].stages);
+                next++;
+            }
+            out += "; ";
+            appendPadded(out, *stage, cycleColWidth - 2);
+        }
+        out += '\n';
+    }
+}
+
+void Processor::printPipelineDiagram() {
     // Find the maximum length of any stage string for proper column sizing
     size_t maxStageLength = 2; 
     for (const auto& tracker : pipelineTable) {
-        for (const auto& stage : tracker.stages) {
-            maxStageLength = max(maxStageLength, stage.length());
+        for (const auto& cell : tracker.cells) {
+            if (cell.cycle >= streamedCycles) {
+                maxStageLength = max(maxStageLength, stageText(cell.stages).length());
+            }
         }
     }
     
-    // Define the column width based on the longest stage
-    const int cycleColWidth = maxStageLength + 3; 
+    // Print ALL instructions regardless of whether they entered the pipeline,
+    // the table is already in PC order
+    vector<uint32_t> rows(pipelineTable.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+        rows[i] = i;
+    }
     
-    // Print cycle numbers at the top
-    cout << left << setw(maxInstrLength) << "Instruction (PC)";
-    for (int i = 0; i < cycleCount; i++) {
-        string cycleHeader = "; C" + to_string(i);
-        cout << left << setw(cycleColWidth) << cycleHeader;
+    // everything from the first cycle (or the checkpoint a run started from)
+    outputBuffer.clear();
+    formatDiagram(outputBuffer, streamedCycles, cycleCount, rows, maxStageLength);
+    output->write(outputBuffer.data(), outputBuffer.size());
+    output->flush();
+}
+
+void Processor::flushStreamWindow(int to) {
+    // Write cycles [streamedCycles, to) for the rows that were active in them,
+    // then drop those cells so memory stays bounded by the window size
+    int from = streamedCycles;
+    if (to <= from) {
+        return;
     }
-    cout << endl;
     
-    // Print a separator line
-    cout << string(maxInstrLength + cycleCount * cycleColWidth, '-') << endl;
+    sort(activeRows.begin(), activeRows.end());
+    vector<uint32_t> rows;
+    size_t maxStageLength = 2;
+    for (uint32_t row : activeRows) {
+        bool printed = false;
+        for (const auto& cell : pipelineTable[row].cells) {
+            if (cell.cycle >= from && cell.cycle < to) {
+                maxStageLength = max(maxStageLength, stageText(cell.stages).length());
+                printed = true;
+            }
+        }
+        if (printed) {
+            rows.push_back(row);
+        }
+    }
     
-    // Sort instructions by their PC for a logical ordering
-    vector<InstructionTracker> sortedTrackers = pipelineTable;
-    sort(sortedTrackers.begin(), sortedTrackers.end(), 
-              [](const InstructionTracker& a, const InstructionTracker& b) {
-                  return a.pc < b.pc;
-              });
+    outputBuffer.clear();
+    if (from > 0) {
+        outputBuffer += '\n';
+    }
+    formatDiagram(outputBuffer, from, to, rows, maxStageLength);
+    output->write(outputBuffer.data(), outputBuffer.size());
+    output->flush();
     
-    // Print ALL instructions regardless of whether they entered the pipeline
-    for (const auto& tracker : sortedTrackers) {
-        // Format instruction with PC
-        ostringstream instrWithPC;
-        instrWithPC << tracker.assembly << " (" << dec << tracker.pc << ")";
-        cout << left << setw(maxInstrLength) << instrWithPC.str();
+    // Evict written cells. The previous cycle's cell is kept because
+    // updateInstructionStage still compares against it.
+    int keepFrom = min(to, cycleCount - 1);
+    size_t kept = 0;
+    for (uint32_t row : activeRows) {
+        InstructionTracker& tracker = pipelineTable[row];
+        vector<StageCell>& cells = tracker.cells;
+        size_t drop = 0;
+        while (drop < cells.size() && cells[drop].cycle < keepFrom) {
+            drop++;
+        }
+        cells.erase(cells.begin(), cells.begin() + drop);
         
-        // Add each stage for each cycle
-        for (size_t i = 0; i < static_cast<size_t>(cycleCount); i++) {
-            string stageOutput = "; ";
-            
-            if (tracker.firstCycle != -1 && i < tracker.stages.size()) {
-                stageOutput += tracker.stages[i];
-            } else {
-                stageOutput += "-"; 
-            }
-            
-            cout << left << setw(cycleColWidth) << stageOutput;
+        // rows with cells still to be written stay active
+        tracker.pendingOutput = !cells.empty() && cells.back().cycle >= to;
+        if (tracker.pendingOutput) {
+            activeRows[kept++] = row;
         }
-        cout << endl;
     }
+    activeRows.resize(kept);
+    streamedCycles = to;
 }
 
-void Processor::updateOrAddInstruction(const string& assembly, const string& stage) {
-    // Find the instruction with matching assembly in the table, or make a new one
-    InstructionTracker instrTracker;
-    instrTracker.assembly = assembly;
-    instrTracker.pc = 0;    
-    instrTracker.firstCycle = cycleCount;
-    instrTracker.stages.resize(cycleCount + 1, "-");
-    instrTracker.stages[cycleCount] = stage;
-    pipelineTable.push_back(instrTracker);
+void Processor::saveCheckpoint(const string& filename, bool includeTracker) const {
+    CheckpointWriter out;
+    out.put(CHECKPOINT_MAGIC);
+    out.put(CHECKPOINT_VERSION);
+    out.put(static_cast<uint32_t>(sizeof(PipelineRegister)));
+    out.put(static_cast<uint8_t>(includeTracker));
+    out.put(memory.getProgram().fingerprint());
+    out.put(static_cast<uint32_t>(variantName.size()));
+    out.putBytes(variantName.data(), variantName.size());
+    
+    // core state, latches are trivially copyable and stored as they are
+    out.put(pc);
+    out.put(btpc);
+    out.put(tibt);
+    out.put(stall);
+    out.put(cycleCount);
+    out.put(instructionCount);
+    registers.saveState(out);
+    out.put(ifId);
+    out.put(idEx);
+    out.put(exMem);
+    out.put(memWb);
+    memory.saveState(out);
+    string predictorName = predictor->name();
+    out.put(static_cast<uint32_t>(predictorName.size()));
+    out.putBytes(predictorName.data(), predictorName.size());
+    predictor->saveState(out);
+    btb.saveState(out);
+    out.put(counters);
+    icache.saveState(out);
+    dcache.saveState(out);
+    out.put(fetchWait);
+    out.put(fetchStarted);
+    out.put(memoryWait);
+    out.put(memoryStarted);
+    out.put(memoryStall);
+    out.put(registerReady);
+    out.put(executeWait);
+    out.put(executeStarted);
+    out.put(executeStall);
+    out.put(depth);
+    for (const vector<PipelineRegister>* line : {&fetchLine, &executeLine, &memoryLine}) {
+        for (const PipelineRegister& latch : *line) {
+            out.put(latch);
+        }
+    }
+    saveVariantState(out, includeTracker);
+    
+    // tracker, at least the last cycle which the next cycle is compared against
+    int keepFrom = includeTracker ? 0 : cycleCount - 1;
+    out.put(includeTracker ? streamedCycles : cycleCount);
+    for (const InstructionTracker& tracker : pipelineTable) {
+        uint32_t kept = 0;
+        for (const StageCell& cell : tracker.cells) {
+            kept += cell.cycle >= keepFrom;
+        }
+        out.put(tracker.firstCycle);
+        out.put(includeTracker && tracker.pendingOutput);
+        out.put(kept);
+        for (const StageCell& cell : tracker.cells) {
+            if (cell.cycle >= keepFrom) {
+                out.put(cell.cycle);
+                out.put(cell.stages);
+            }
+        }
+    }
+    out.save(filename);
 }
 
+void Processor::loadCheckpoint(const string& filename) {
+    CheckpointReader in(filename);
+    if (in.get<uint32_t>() != CHECKPOINT_MAGIC || in.get<uint32_t>() != CHECKPOINT_VERSION ||
+        in.get<uint32_t>() != sizeof(PipelineRegister)) {
+        throw runtime_error("Not a checkpoint of this simulator version: " + filename);
+    }
+    in.get<uint8_t>(); // tracker included or not, the layout is the same
+    if (in.get<uint64_t>() != memory.getProgram().fingerprint()) {
+        throw runtime_error("Checkpoint was taken with a different program: " + filename);
+    }
+    if (in.getView(in.get<uint32_t>()) != variantName) {
+        throw runtime_error("Checkpoint was taken with a different processor variant: " + filename);
+    }
+    
+    pc = in.get<uint32_t>();
+    btpc = in.get<uint32_t>();
+    tibt = in.get<bool>();
+    stall = in.get<bool>();
+    cycleCount = in.get<int>();
+    instructionCount = in.get<uint64_t>();
+    registers.restoreState(in);
+    ifId = in.get<PipelineRegister>();
+    idEx = in.get<PipelineRegister>();
+    exMem = in.get<PipelineRegister>();
+    memWb = in.get<PipelineRegister>();
+    memory.restoreState(in);
+    if (in.getView(in.get<uint32_t>()) != predictor->name()) {
+        throw runtime_error("Checkpoint was taken with a different branch predictor: " + filename);
+    }
+    predictor->restoreState(in);
+    btb.restoreState(in);
+    counters = in.get<PerfCounters>();
+    icache.restoreState(in);
+    dcache.restoreState(in);
+    fetchWait = in.get<uint32_t>();
+    fetchStarted = in.get<bool>();
+    memoryWait = in.get<uint32_t>();
+    memoryStarted = in.get<bool>();
+    memoryStall = in.get<bool>();
+    registerReady = in.get<array<int, 32>>();
+    executeWait = in.get<int>();
+    executeStarted = in.get<bool>();
+    executeStall = in.get<bool>();
+    if (!(in.get<PipelineDepth>() == depth)) {
+        throw runtime_error("Checkpoint was taken with a different pipeline depth: " + filename);
+    }
+    for (vector<PipelineRegister>* line : {&fetchLine, &executeLine, &memoryLine}) {
+        for (PipelineRegister& latch : *line) {
+            latch = in.get<PipelineRegister>();
+        }
+    }
+    restoreVariantState(in);
+    
+    streamedCycles = in.get<int>();
+    activeRows.clear();
+    for (size_t row = 0; row < pipelineTable.size(); row++) {
+        InstructionTracker& tracker = pipelineTable[row];
+        tracker.firstCycle = in.get<int>();
+        tracker.pendingOutput = in.get<bool>();
+        tracker.cells.resize(in.get<uint32_t>());
+        for (StageCell& cell : tracker.cells) {
+            cell.cycle = in.get<int>();
+            cell.stages = in.get<uint16_t>();
+        }
+        if (tracker.pendingOutput) {
+            activeRows.push_back(row);
+        }
+    }
+}
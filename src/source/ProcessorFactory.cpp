@@ -0,0 +1,22 @@
+#include "../include/ProcessorFactory.hpp"
+#include "../include/ForwardingProcessor.hpp"
+#include "../include/NonForwardingProcessor.hpp"
+#include "../include/DualIssueProcessor.hpp"
+#include "../include/OutOfOrderProcessor.hpp"
+using namespace std;
+
+unique_ptr<Processor> createProcessor(const string& variant) {
+    if (variant == "forward") {
+        return make_unique<ForwardingProcessor>();
+    }
+    if (variant == "noforward") {
+        return make_unique<NonForwardingProcessor>();
+    }
+    if (variant == "dualissue") {
+        return make_unique<DualIssueProcessor>();
+    }
+    if (variant == "outoforder") {
+        return make_unique<OutOfOrderProcessor>();
+    }
+    return nullptr;
+}
@@ -0,0 +1,233 @@
+#include "../include/ProgramImage.hpp"
+#include <charconv>
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+using namespace std;
+
+// returned for fetches beyond the end of the program
+const Instruction ProgramImage::nopInstruction;
+
+ProgramImage::ProgramImage() : format(Format::TEXT), textBase(0), entryPoint(0) {
+}
+
+shared_ptr<const ProgramImage> ProgramImage::load(const string& filename) {
+    auto image = make_shared<ProgramImage>();
+    
+    // map the file once, every format is parsed in place
+    try {
+        image->file = MappedFile(filename);
+    } catch (const runtime_error&) {
+        throw runtime_error("Could not open instruction file: " + filename);
+    }
+    
+    string_view contents = image->file.view();
+    bool isElf = contents.size() >= 4 && contents.substr(0, 4) == "\x7f" "ELF";
+    bool isBinary = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0;
+    if (isElf) {
+        image->parseElf(filename);
+    } else if (isBinary) {
+        image->parseBinary(filename);
+    } else {
+        image->parseText(filename);
+    }
+    
+    if (image->instructions.empty()) {
+        throw runtime_error("No valid instructions found in file: " + filename);
+    }
+    return image;
+}
+
+string_view ProgramImage::getAssembly(uint32_t pc) const {
+    size_t index = (pc - textBase) / 4;
+    if (index >= assembly.size()) {
+        return "NOP";
+    }
+    return assembly[index];
+}
+
+uint64_t ProgramImage::fingerprint() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    mix(&textBase, sizeof(textBase));
+    mix(&entryPoint, sizeof(entryPoint));
+    for (const Instruction& instr : instructions) {
+        uint32_t code = instr.getMachineCode();
+        mix(&code, sizeof(code));
+    }
+    for (const Segment& segment : segments) {
+        mix(&segment.address, sizeof(segment.address));
+        mix(segment.bytes.data(), segment.bytes.size());
+    }
+    return hash;
+}
+
+// Parse a hex machine code token like the old stringstream >> hex did:
+// optional 0x prefix, stops at the first non-hex character, 0 if no digits
+static uint32_t parseHexToken(string_view token) {
+    if (token.size() >= 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')) {
+        token.remove_prefix(2);
+    }
+    uint32_t value = 0;
+    from_chars_result result = from_chars(token.data(), token.data() + token.size(), value, 16);
+    if (result.ec == errc::result_out_of_range) {
+        value = numeric_limits<uint32_t>::max();
+    }
+    return value;
+}
+
+static bool isSpace(char c) {
+    return isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+void ProgramImage::parseText(const string&) {
+    format = Format::TEXT;
+    string_view text = file.view();
+    
+    size_t lineStart = 0;
+    while (lineStart < text.size()) {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == string_view::npos) {
+            lineEnd = text.size();
+        }
+        string_view line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        
+        // Skip empty lines and comments
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        
+        // Read the first token as machine code
+        size_t pos = 0;
+        while (pos < line.size() && isSpace(line[pos])) {
+            pos++;
+        }
+        size_t tokenStart = pos;
+        while (pos < line.size() && !isSpace(line[pos])) {
+            pos++;
+        }
+        uint32_t machineCode = parseHexToken(line.substr(tokenStart, pos - tokenStart));
+        
+        // Rest of line is the assembly code, without leading/trailing whitespace
+        while (pos < line.size() && isSpace(line[pos])) {
+            pos++;
+        }
+        string_view asmText = line.substr(pos);
+        size_t last = asmText.find_last_not_of(" \t\r\n");
+        asmText = (last == string_view::npos) ? string_view() : asmText.substr(0, last + 1);
+        
+        instructions.emplace_back(machineCode);
+        assembly.push_back(asmText);
+    }
+}
+
+void ProgramImage::decodeWords(const uint8_t* bytes, size_t count) {
+    instructions.reserve(count);
+    vector<size_t> offsets;
+    offsets.reserve(count + 1);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t word;
+        memcpy(&word, bytes + i * 4, sizeof(word));
+        instructions.emplace_back(word);
+        offsets.push_back(generatedText.size());
+        generatedText += instructions.back().disassemble();
+    }
+    offsets.push_back(generatedText.size());
+    
+    // views are only taken once generatedText has stopped growing
+    string_view all = generatedText;
+    for (size_t i = 0; i < count; i++) {
+        assembly.push_back(all.substr(offsets[i], offsets[i + 1] - offsets[i]));
+    }
+}
+
+void ProgramImage::parseBinary(const string&) {
+    // flat image: code and data from address 0, execution starts at 0
+    format = Format::BINARY;
+    string_view bytes = file.view();
+    segments.push_back({0, bytes, static_cast<uint32_t>(bytes.size())});
+    decodeWords(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size() / 4);
+}
+
+// little-endian field readers for the ELF headers
+static uint16_t read16(string_view bytes, size_t offset) {
+    uint16_t value;
+    memcpy(&value, bytes.data() + offset, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(string_view bytes, size_t offset) {
+    uint32_t value;
+    memcpy(&value, bytes.data() + offset, sizeof(value));
+    return value;
+}
+
+void ProgramImage::parseElf(const string& filename) {
+    static const uint16_t EM_RISCV = 243;
+    static const uint32_t PT_LOAD = 1;
+    static const uint32_t PF_X = 1;
+    static const size_t EHDR_SIZE = 52;
+    static const size_t PHDR_SIZE = 32;
+    
+    format = Format::ELF;
+    string_view elf = file.view();
+    if (elf.size() < EHDR_SIZE || elf[4] != 1 || elf[5] != 1) {
+        throw runtime_error("Not a little-endian ELF32 file: " + filename);
+    }
+    if (read16(elf, 18) != EM_RISCV) {
+        throw runtime_error("ELF file is not a RISC-V executable: " + filename);
+    }
+    entryPoint = read32(elf, 24);
+    uint32_t phoff = read32(elf, 28);
+    uint16_t phentsize = read16(elf, 42);
+    uint16_t phnum = read16(elf, 44);
+    if (phentsize < PHDR_SIZE || phoff + static_cast<uint64_t>(phnum) * phentsize > elf.size()) {
+        throw runtime_error("Truncated ELF program headers: " + filename);
+    }
+    
+    // every PT_LOAD segment initializes data memory at its linked address,
+    // executable ones also make up the instruction image
+    uint64_t textStart = UINT64_MAX;
+    uint64_t textEnd = 0;
+    for (uint16_t i = 0; i < phnum; i++) {
+        size_t ph = phoff + static_cast<size_t>(i) * phentsize;
+        if (read32(elf, ph) != PT_LOAD) {
+            continue;
+        }
+        uint32_t offset = read32(elf, ph + 4);
+        uint32_t vaddr = read32(elf, ph + 8);
+        uint32_t filesz = read32(elf, ph + 16);
+        uint32_t memsz = read32(elf, ph + 20);
+        uint32_t flags = read32(elf, ph + 24);
+        if (static_cast<uint64_t>(offset) + filesz > elf.size()) {
+            throw runtime_error("Truncated ELF segment: " + filename);
+        }
+        segments.push_back({vaddr, elf.substr(offset, filesz), max(memsz, filesz)});
+        if (flags & PF_X) {
+            textStart = min<uint64_t>(textStart, vaddr);
+            textEnd = max<uint64_t>(textEnd, static_cast<uint64_t>(vaddr) + filesz);
+        }
+    }
+    if (textStart >= textEnd) {
+        throw runtime_error("ELF file has no executable segment: " + filename);
+    }
+    
+    // assemble the text span (gaps between segments read as zero) and decode it
+    textBase = static_cast<uint32_t>(textStart) & ~3u;
+    vector<uint8_t> text((textEnd - textBase + 3) & ~3ull, 0);
+    for (const Segment& segment : segments) {
+        uint64_t start = max<uint64_t>(segment.address, textBase);
+        uint64_t end = min<uint64_t>(static_cast<uint64_t>(segment.address) + segment.bytes.size(), textEnd);
+        if (start < end) {
+            memcpy(text.data() + (start - textBase), segment.bytes.data() + (start - segment.address), end - start);
+        }
+    }
+    decodeWords(text.data(), text.size() / 4);
+}
@@ -22,3 +22,11 @@ void RegisterFile::reset() {
         registers[i] = 0;
     }
 }
+
+void RegisterFile::saveState(CheckpointWriter& out) const {
+    out.put(registers);
+}
+
+void RegisterFile::restoreState(CheckpointReader& in) {
+    registers = in.get<array<int, 32>>();
+}
@@ -0,0 +1,89 @@
+#include "../include/WorkStealingPool.hpp"
+using namespace std;
+
+WorkStealingPool::WorkStealingPool(size_t threadCount)
+    : queued(0), pending(0), nextQueue(0), stopping(false) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        queues.push_back(make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> guard(idleLock);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (thread& worker : threads) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    Queue& queue = *queues[nextQueue];
+    nextQueue = (nextQueue + 1) % queues.size();
+    pending++;
+    {
+        lock_guard<mutex> guard(queue.lock);
+        queue.tasks.push_back(move(task));
+    }
+    {
+        // under idleLock so a worker about to sleep can't miss it
+        lock_guard<mutex> guard(idleLock);
+        queued++;
+    }
+    wakeUp.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    unique_lock<mutex> guard(idleLock);
+    finished.wait(guard, [this] { return pending == 0; });
+}
+
+bool WorkStealingPool::take(size_t self, Task& task) {
+    // own queue from the back, then the front of the others
+    for (size_t i = 0; i < queues.size(); i++) {
+        Queue& queue = *queues[(self + i) % queues.size()];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::workerLoop(size_t self) {
+    Task task;
+    while (true) {
+        if (take(self, task)) {
+            task();
+            task = nullptr;
+            if (--pending == 0) {
+                lock_guard<mutex> guard(idleLock);
+                finished.notify_all();
+            }
+            continue;
+        }
+        
+        unique_lock<mutex> guard(idleLock);
+        wakeUp.wait(guard, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
@@ -1,13 +1,82 @@
-#include "../include/ForwardingProcessor.hpp"
-#include "../include/NonForwardingProcessor.hpp"
+#include "../include/ProcessorFactory.hpp"
+#include "../include/OutOfOrderProcessor.hpp"
+#include "../include/MultiHartRunner.hpp"
+#include <memory>
+#include <cstring>
+#include <chrono>
+#include <fstream>
 using namespace std;
 
 void printUsage(const string& progName) {
-    cerr << "Usage: " << progName << " <instruction_file> <cycle_count>\n";
+    cerr << "Usage: " << progName << " <instruction_file> <cycle_count> [options]\n"
+         << "Options:\n"
+         << "  --halt              stop at ecall/ebreak or once the pipeline drained past the end of\n"
+         << "                      the program, cycle_count is then a limit; exits with a0 of the ecall\n"
+         << "  --window <cycles>   stream the diagram in windows of this many cycles\n"
+         << "  --fast-forward <n>  execute n instructions functionally before the pipeline starts\n"
+         << "  --load-state <file> continue from a checkpoint of the same program\n"
+         << "  --save-state <file> write a checkpoint after the last cycle\n"
+         << "  --no-tracker        leave the diagram history out of the checkpoint\n"
+         << "  --trap-misaligned   stop with an error on misaligned loads/stores\n"
+         << "  --predictor <name>  branch predictor: not-taken (default), btfn, bimodal, gshare\n"
+         << "  --btb <entries>     predict jump targets with a branch target buffer\n"
+         << "  --icache <spec>     model an L1 instruction cache, spec is key=value,... from\n"
+         << "                      size=8k,line=32,ways=2,repl=lru|plru|random,write=back|through,latency=10\n"
+         << "  --dcache <spec>     same for an L1 data cache\n"
+         << "  --mul-latency <n>   cycles of the pipelined multiplier (default 1)\n"
+         << "  --div-latency <n>   cycles of the blocking divider (default 1)\n"
+         << "  --depth <spec>      sub-stages of IF, EX and MEM (forward/noforward), e.g. if=2,ex=2,mem=2\n"
+         << "  --rob <entries>     outoforder: reorder buffer size (default 32)\n"
+         << "  --iq <entries>      outoforder: issue queue size (default 16)\n"
+         << "  --lsq <entries>     outoforder: load/store queue size (default 8)\n"
+         << "  --harts <n>         run n harts (forward/noforward) on one shared memory\n"
+         << "  --quantum <cycles>  cycles the harts run between two barriers (default 100)\n"
+         << "  --threads <n>       host threads for the harts (default one per hart and core)\n"
+         << "  --json <file>       write the performance counters as JSON (- for stdout)\n"
+         << "  --no-diagram        don't track or print the pipeline diagram\n"
+         << "  --stats             report load/simulation times and branch prediction on stderr\n";
+}
+
+// parse a positive integer option value, false if it isn't one
+bool parsePositive(const char* text, int& value) {
+    try {
+        size_t used = 0;
+        value = stoi(text, &used);
+        return used == strlen(text) && value > 0;
+    } catch (const exception&) {
+        return false;
+    }
+}
+
+// same for instruction counts, which may not fit an int
+bool parseCount(const char* text, uint64_t& value) {
+    try {
+        size_t used = 0;
+        value = stoull(text, &used);
+        return isdigit(static_cast<unsigned char>(text[0])) && used == strlen(text) && value > 0;
+    } catch (const exception&) {
+        return false;
+    }
+}
+
+// Write the counters of a processor or of all harts as JSON, - for stdout
+template <class Simulation>
+void writeCounters(const Simulation& simulation, const string& jsonFile) {
+    if (jsonFile == "-") {
+        simulation.writeCountersJson(cout);
+        cout << "\n";
+        return;
+    }
+    ofstream json(jsonFile);
+    if (!json) {
+        throw runtime_error("Could not write " + jsonFile);
+    }
+    simulation.writeCountersJson(json);
+    json << "\n";
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    if (argc < 3) {
         printUsage(argv[0]);
         return 1;
     }
@@ -27,6 +96,113 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
+    // optional flags after the positional arguments
+    int streamWindow = 0;
+    uint64_t fastForward = 0;
+    string loadState;
+    string saveState;
+    bool saveTracker = true;
+    bool trapMisaligned = false;
+    bool showStats = false;
+    string predictorName = "not-taken";
+    int btbEntries = 0;
+    string jsonFile;
+    Cache::Config icacheConfig;
+    Cache::Config dcacheConfig;
+    bool useIcache = false;
+    bool useDcache = false;
+    int mulLatency = 1;
+    int divLatency = 1;
+    Processor::PipelineDepth depth;
+    bool depthSet = false;
+    OutOfOrderProcessor::QueueSizes queueSizes;
+    bool queueSizesSet = false;
+    bool showDiagram = true;
+    int hartCount = 1;
+    int quantum = 100;
+    int threadCount = 0;
+    bool haltMode = false;
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--window" && i + 1 < argc) {
+            if (!parsePositive(argv[++i], streamWindow)) {
+                cerr << "Error: --window needs a positive cycle count\n";
+                return 1;
+            }
+        } else if (arg == "--fast-forward" && i + 1 < argc) {
+            if (!parseCount(argv[++i], fastForward)) {
+                cerr << "Error: --fast-forward needs a positive instruction count\n";
+                return 1;
+            }
+        } else if (arg == "--load-state" && i + 1 < argc) {
+            loadState = argv[++i];
+        } else if (arg == "--save-state" && i + 1 < argc) {
+            saveState = argv[++i];
+        } else if (arg == "--halt") {
+            haltMode = true;
+        } else if (arg == "--no-tracker") {
+            saveTracker = false;
+        } else if (arg == "--trap-misaligned") {
+            trapMisaligned = true;
+        } else if (arg == "--predictor" && i + 1 < argc) {
+            predictorName = argv[++i];
+            if (!createBranchPredictor(predictorName)) {
+                cerr << "Error: --predictor must be not-taken, btfn, bimodal or gshare\n";
+                return 1;
+            }
+        } else if (arg == "--btb" && i + 1 < argc) {
+            if (!parsePositive(argv[++i], btbEntries)) {
+                cerr << "Error: --btb needs a positive entry count\n";
+                return 1;
+            }
+        } else if ((arg == "--icache" || arg == "--dcache") && i + 1 < argc) {
+            try {
+                Cache::Config config = Cache::Config::parse(argv[++i]);
+                (arg == "--icache" ? icacheConfig : dcacheConfig) = config;
+                (arg == "--icache" ? useIcache : useDcache) = true;
+            } catch (const exception& e) {
+                cerr << "Error: " << arg << ": " << e.what() << "\n";
+                return 1;
+            }
+        } else if ((arg == "--mul-latency" || arg == "--div-latency") && i + 1 < argc) {
+            if (!parsePositive(argv[++i], arg == "--mul-latency" ? mulLatency : divLatency)) {
+                cerr << "Error: " << arg << " needs a positive cycle count\n";
+                return 1;
+            }
+        } else if (arg == "--depth" && i + 1 < argc) {
+            try {
+                depth = Processor::PipelineDepth::parse(argv[++i]);
+                depthSet = true;
+            } catch (const exception& e) {
+                cerr << "Error: --depth: " << e.what() << "\n";
+                return 1;
+            }
+        } else if ((arg == "--rob" || arg == "--iq" || arg == "--lsq") && i + 1 < argc) {
+            int& size = arg == "--rob" ? queueSizes.reorderBuffer
+                      : arg == "--iq" ? queueSizes.issueQueue : queueSizes.loadStoreQueue;
+            if (!parsePositive(argv[++i], size)) {
+                cerr << "Error: " << arg << " needs a positive entry count\n";
+                return 1;
+            }
+            queueSizesSet = true;
+        } else if ((arg == "--harts" || arg == "--quantum" || arg == "--threads") && i + 1 < argc) {
+            int& value = arg == "--harts" ? hartCount : arg == "--quantum" ? quantum : threadCount;
+            if (!parsePositive(argv[++i], value)) {
+                cerr << "Error: " << arg << " needs a positive number\n";
+                return 1;
+            }
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (arg == "--no-diagram") {
+            showDiagram = false;
+        } else if (arg == "--stats") {
+            showStats = true;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    
     // which processor - forwarding or non-forwarding
     string exeName = argv[0];
     string::size_type lastSlash = exeName.find_last_of("/\\");
@@ -34,21 +210,130 @@ int main(int argc, char* argv[]) {
         exeName = exeName.substr(lastSlash + 1);
     }
     
-    unique_ptr<Processor> processor;
-
     //make the call acoording to given processor type
-    if (exeName == "forward") {
-        processor = make_unique<ForwardingProcessor>();
-    } else if (exeName == "noforward") {
-        processor = make_unique<NonForwardingProcessor>();
-    } else {
-        cerr << "Error: Unknown executable name. Expected 'forward' or 'noforward'.\n";
+    unique_ptr<Processor> processor = createProcessor(exeName);
+    if (!processor) {
+        cerr << "Error: Unknown executable name. Expected 'forward', 'noforward', 'dualissue' or 'outoforder'.\n";
         return 1;
     }
     
+    // the same settings for the processor or for every hart
+    auto configure = [&](Processor& target) {
+        target.setStreamWindow(streamWindow);
+        target.setMisalignedTrap(trapMisaligned);
+        target.setBranchPredictor(createBranchPredictor(predictorName));
+        target.setBtbSize(btbEntries);
+        target.setDiagramEnabled(showDiagram);
+        target.setUnitLatencies(mulLatency, divLatency);
+        target.setHaltEnabled(haltMode);
+        if (depthSet) {
+            target.setPipelineDepth(depth);
+        }
+        if (useIcache) {
+            target.setInstructionCache(icacheConfig);
+        }
+        if (useDcache) {
+            target.setDataCache(dcacheConfig);
+        }
+        if (queueSizesSet) {
+            auto* core = dynamic_cast<OutOfOrderProcessor*>(&target);
+            if (!core) {
+                throw runtime_error("--rob, --iq and --lsq only apply to outoforder");
+            }
+            core->setQueueSizes(queueSizes);
+        }
+    };
+    
     try {
+        if (hartCount > 1) {
+            // the processor made above is hart 0, the others are made like it
+            if (!loadState.empty() || !saveState.empty() || fastForward > 0) {
+                throw runtime_error("--load-state, --save-state and --fast-forward only run a single hart");
+            }
+            MultiHartRunner system(quantum, threadCount);
+            system.addHart(move(processor));
+            for (int i = 1; i < hartCount; i++) {
+                system.addHart(createProcessor(exeName));
+            }
+            system.loadProgram(filename);
+            for (int i = 0; i < hartCount; i++) {
+                configure(system.getHart(i));
+            }
+            
+            auto runStart = chrono::steady_clock::now();
+            system.run(cycles, cout);
+            auto runEnd = chrono::steady_clock::now();
+            if (!jsonFile.empty()) {
+                writeCounters(system, jsonFile);
+            }
+            if (showStats) {
+                double runSeconds = chrono::duration<double>(runEnd - runStart).count();
+                uint64_t hartCycles = 0;
+                for (size_t i = 0; i < system.getHartCount(); i++) {
+                    hartCycles += system.getHart(i).getCycleCount();
+                }
+                cerr << fixed << setprecision(1)
+                     << "Simulated " << hartCycles << " cycles on " << hartCount << " harts in "
+                     << runSeconds * 1e3 << " ms (" << static_cast<double>(hartCycles) / runSeconds
+                     << " hart cycles/s, diagram output included)\n";
+                system.printStats(cerr);
+            }
+            if (!haltMode) {
+                return 0;
+            }
+            for (size_t i = 0; i < system.getHartCount(); i++) {
+                cerr << "Hart " << i << ": ";
+                system.getHart(i).printHaltReport(cerr);
+            }
+            return system.getHart(0).getExitStatus();
+        }
+        
+        auto loadStart = chrono::steady_clock::now();
         processor->loadProgram(filename);
+        auto loadEnd = chrono::steady_clock::now();
+        
+        configure(*processor);
+        if (!loadState.empty()) {
+            processor->loadCheckpoint(loadState);
+        }
+        if (fastForward > 0) {
+            processor->fastForward(fastForward);
+        }
+        auto forwardEnd = chrono::steady_clock::now();
+        int startCycle = processor->getCycleCount();
         processor->run(cycles);
+        int simulated = processor->getCycleCount() - startCycle;
+        auto runEnd = chrono::steady_clock::now();
+        if (!saveState.empty()) {
+            processor->saveCheckpoint(saveState, saveTracker);
+        }
+        if (!jsonFile.empty()) {
+            writeCounters(*processor, jsonFile);
+        }
+        
+        if (showStats) {
+            double loadNs = chrono::duration<double, nano>(loadEnd - loadStart).count();
+            double runSeconds = chrono::duration<double>(runEnd - forwardEnd).count();
+            size_t count = processor->getProgramSize();
+            cerr << fixed << setprecision(1)
+                 << "Loaded " << count << " instructions in " << loadNs / 1e6 << " ms ("
+                 << loadNs / count << " ns/instruction)\n";
+            if (fastForward > 0) {
+                double forwardSeconds = chrono::duration<double>(forwardEnd - loadEnd).count();
+                cerr << "Fast-forwarded " << fastForward << " instructions in " << forwardSeconds * 1e3
+                     << " ms (" << fastForward / forwardSeconds / 1e6 << " MIPS)\n";
+            }
+            cerr << "Simulated " << simulated << " cycles in " << runSeconds * 1e3 << " ms ("
+                 << simulated / runSeconds << " cycles/s, diagram output included)\n"
+                 << "Misaligned accesses: " << processor->getMisalignedAccesses() << "\n";
+            processor->printBranchStats(cerr);
+            processor->printCacheStats(cerr);
+            processor->printVariantStats(cerr);
+        }
+        if (haltMode) {
+            processor->printHaltReport(cerr);
+            return processor->getExitStatus();
+        }
     } catch (const exception& e) {
         cerr << "Error: " << e.what() << "\n";
         return 1;
@@ -0,0 +1,74 @@
+#include "../include/BatchRunner.hpp"
+#include <iostream>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <fstream>
+using namespace std;
+
+void printUsage(const string& progName) {
+    cerr << "Usage: " << progName << " <manifest> [options]\n"
+         << "Manifest lines: <input file> <forward|noforward|dualissue|outoforder> <cycles> [output file]\n"
+         << "Options:\n"
+         << "  --threads <n>        worker threads (default: all cores)\n"
+         << "  --expected <dir>     expected outputs for jobs without an output file\n"
+         << "                       (default: outputfiles/expected)\n"
+         << "  --json <file>        write the performance counters of every job as JSON lines\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    size_t threads = thread::hardware_concurrency();
+    string expectedDir = "outputfiles/expected";
+    string jsonFile;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            try {
+                int value = stoi(argv[++i]);
+                if (value <= 0) {
+                    throw invalid_argument("threads");
+                }
+                threads = value;
+            } catch (const exception&) {
+                cerr << "Error: --threads needs a positive count\n";
+                return 1;
+            }
+        } else if (arg == "--expected" && i + 1 < argc) {
+            expectedDir = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    
+    try {
+        BatchRunner batch(expectedDir);
+        batch.loadManifest(argv[1]);
+        
+        auto start = chrono::steady_clock::now();
+        batch.run(threads);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        size_t failed = batch.report(cout);
+        if (!jsonFile.empty()) {
+            ofstream json(jsonFile);
+            if (!json) {
+                throw runtime_error("Could not write " + jsonFile);
+            }
+            batch.writeJson(json);
+        }
+        cerr << "Ran " << batch.getJobCount() << " jobs on " << max<size_t>(threads, 1)
+             << " threads in " << seconds * 1e3 << " ms\n";
+        return failed == 0 ? 0 : 1;
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}